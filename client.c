@@ -0,0 +1,212 @@
+#include "src/daemon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/*
+ * A small client of the sobel daemon, sends the same request as many times as
+ * asked over one connection and reports how long each one has taken.
+ */
+
+void print_usage() {
+	printf("Usage: [-d] [-n COUNT] <socket path> <source path> <target path>\n");
+	printf("Options:\n");
+	printf("  -d        send the image itself (- for stdin) and write the P5 result to TARGET (- for stdout)\n");
+	printf("            instead of letting the daemon read and write the files\n");
+	printf("  -n COUNT  send the request COUNT times\n");
+}
+
+double get_timestamp(struct timeval from, struct timeval to) {
+	double timestamp = (to.tv_sec - from.tv_sec);
+	if (to.tv_usec < from.tv_usec) {
+		timestamp -= (from.tv_usec - to.tv_usec) / 1000000.0;
+	} else {
+		timestamp += (to.tv_usec - from.tv_usec) / 1000000.0;
+	}
+
+	return timestamp;
+}
+
+/*
+ * Reads the whole stream into memory.
+ *
+ * Returns NULL if error occurred, otherwise the bytes to be freed and their number in *size.
+ */
+u_int8_t *read_all(FILE *stream, size_t *size) {
+	size_t capacity = 1 << 16;
+	u_int8_t *bytes = (u_int8_t *) malloc(capacity);
+	*size = 0;
+
+	size_t count;
+	while ((count = fread(bytes + *size, 1, capacity - *size, stream)) > 0) {
+		*size += count;
+		if (*size == capacity) {
+			capacity *= 2;
+			bytes = (u_int8_t *) realloc(bytes, capacity);
+		}
+	}
+
+	if (ferror(stream)) {
+		free(bytes);
+		return NULL;
+	}
+
+	return bytes;
+}
+
+/*
+ * The daemon does not share the working directory of the client,
+ * so relative paths are sent as absolute ones.
+ *
+ * Returns the absolute path, to be freed.
+ */
+char *get_absolute_path(char *path) {
+	if (path[0] == '/') return strdup(path);
+
+	char directory[PATH_MAX];
+	if (getcwd(directory, sizeof(directory)) == NULL) return strdup(path);
+
+	char *result = (char *) malloc(strlen(directory) + strlen(path) + 2);
+	sprintf(result, "%s/%s", directory, path);
+
+	return result;
+}
+
+int main(int argc, char **argv) {
+	int send_data = 0;
+	int repeats = 1;
+
+	int option;
+	while ((option = getopt(argc, argv, "dn:")) != -1) {
+		switch (option) {
+			case 'd':
+				send_data = 1;
+				break;
+			case 'n':
+				repeats = atoi(optarg);
+				if (repeats < 1) {
+					printf("<client>: incorrect count \"%s\".\n", optarg);
+					return -1;
+				}
+				break;
+			default:
+				print_usage();
+				return -1;
+		}
+	}
+
+	if (argc - optind < 3) {
+		print_usage();
+		return -1;
+	}
+
+	char *socket_path = argv[optind];
+	char *source = argv[optind + 1];
+	char *target = argv[optind + 2];
+
+	// the result going to the standard output must not be mixed with the log messages
+	FILE *result_stream = NULL;
+	if (send_data && strcmp(target, "-") == 0) {
+		result_stream = fdopen(dup(STDOUT_FILENO), "w");
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		printf("<client>: the socket path is too long.\n");
+		return -1;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (socket_fd < 0 || connect(socket_fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+		printf("<client>: could not connect to \"%s\".\n", socket_path);
+		return -1;
+	}
+
+	FILE *input = fdopen(socket_fd, "r");
+	FILE *output = fdopen(dup(socket_fd), "w");
+
+	// the request is the same every time
+	u_int8_t *image = NULL;
+	size_t image_size = 0;
+	char *source_path = NULL, *target_path = NULL;
+	if (send_data) {
+		FILE *stream = strcmp(source, "-") == 0 ? stdin : fopen(source, "rb");
+		if (stream != NULL) image = read_all(stream, &image_size);
+		if (stream != NULL && stream != stdin) fclose(stream);
+		if (image == NULL) {
+			printf("<client>: could not read the source.\n");
+			return -1;
+		}
+	} else {
+		source_path = get_absolute_path(source);
+		target_path = get_absolute_path(target);
+	}
+
+	int failed = 0;
+	u_int8_t *answer = NULL;
+	size_t answer_size = 0;
+	for (int i = 0; i < repeats && !failed; i++) {
+		struct timeval start_time, stop_time;
+		gettimeofday(&start_time, NULL);
+
+		if (send_data) {
+			fprintf(output, "%s %zu\n", DAEMON_DATA_REQUEST, image_size);
+			fwrite(image, 1, image_size, output);
+		} else {
+			fprintf(output, "%s\n%s\n%s\n", DAEMON_PATH_REQUEST, source_path, target_path);
+		}
+		fflush(output);
+
+		char line[DAEMON_LINE_SIZE];
+		unsigned long daemon_time;
+		if (fgets(line, sizeof(line), input) == NULL) {
+			printf("<client>: the daemon has closed the connection.\n");
+			failed = 1;
+			break;
+		}
+		if (sscanf(line, "OK %lu", &daemon_time) != 1) {
+			printf("<client>: the daemon has answered: %s", line);
+			failed = 1;
+			break;
+		}
+
+		if (send_data) {
+			answer_size = strtoul(strchr(line + 3, ' ') + 1, NULL, 10);
+			answer = (u_int8_t *) realloc(answer, answer_size + 1);
+			if (fread(answer, 1, answer_size, input) != answer_size) {
+				printf("<client>: the answer of the daemon is incomplete.\n");
+				failed = 1;
+				break;
+			}
+		}
+
+		gettimeofday(&stop_time, NULL);
+		printf("<client>: request %d took %.3f ms, %.3f ms of them in the daemon.\n", i + 1,
+		       get_timestamp(start_time, stop_time) * 1e3, daemon_time / 1e3);
+	}
+
+	if (!failed && send_data) {
+		FILE *stream = result_stream != NULL ? result_stream : fopen(target, "wb");
+		if (stream == NULL || fwrite(answer, 1, answer_size, stream) != answer_size) {
+			printf("<client>: could not write the target.\n");
+			failed = 1;
+		}
+		if (stream != NULL) fclose(stream);
+	}
+
+	fclose(input);
+	fclose(output);
+	free(image);
+	free(answer);
+	free(source_path);
+	free(target_path);
+
+	return failed ? -1 : 0;
+}
@@ -1,8 +1,296 @@
 #include "src/sobel.h"
+#include "src/stream.h"
+#include "src/incremental.h"
+#include "src/region.h"
+#include "src/index.h"
+#include "src/pyramid.h"
+#include "src/threshold.h"
+#include "src/edgemap.h"
+#include "src/kernels.h"
+#include "src/tuning.h"
+#include "src/daemon.h"
+#include "src/median.h"
+#include "src/morphology.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
 #include <sys/time.h>
 #include "src/colors.h"
 
+/*
+ * Command line options, the positional arguments are
+ * the source path, the target path and the number of threads.
+ */
+static const struct option long_options[] = {
+	{"gray", required_argument, NULL, 'g'},
+	{"color", required_argument, NULL, 'c'},
+	{"stream", no_argument, NULL, 's'},
+	{"incremental", optional_argument, NULL, 'i'},
+	{"region", required_argument, NULL, 'r'},
+	{"index", optional_argument, NULL, 'x'},
+	{"pyramid", required_argument, NULL, 'p'},
+	{"level", required_argument, NULL, 'l'},
+	{"downscale", required_argument, NULL, 'd'},
+	{"threshold", required_argument, NULL, 't'},
+	{"edges", required_argument, NULL, 'e'},
+	{"expand", no_argument, NULL, 'E'},
+	{"daemon", required_argument, NULL, 'D'},
+	{"memory", required_argument, NULL, 'm'},
+	{"median", required_argument, NULL, 'M'},
+	{"ring", required_argument, NULL, 'R'},
+	{"from-ring", no_argument, NULL, 'F'},
+	{"morphology", required_argument, NULL, 'o'},
+	{NULL, 0, NULL, 0}
+};
+
+/*
+ * Parses a number of threads given on the command line.
+ *
+ * Returns -1 if the text is not a number of at least one, otherwise returns 0.
+ */
+int parse_threads(char *text, int *threads) {
+	char *end;
+	long value = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || value < 1 || value > INT_MAX) return -1;
+
+	*threads = (int) value;
+	return 0;
+}
+
+void print_usage() {
+	printf("Usage: [options] <source path> <target path> <# of threads or auto>\n");
+	printf("       --stream [options] <source stream or -> <target stream or -> <# of threads or auto>\n");
+	printf("       --stream --ring=NAME[,SLOTS] [options] <source stream or -> <# of threads or auto>\n");
+	printf("       --from-ring <ring name> <target stream or ->\n");
+	printf("       --daemon=SOCKET [options] <# of threads>\n");
+	printf("Options:\n");
+	printf("  -g, --gray=MODE    grayscale conversion: average (default), bt601 or bt709\n");
+	printf("  -c, --color=MODE   sobel on the RGB channels combined by max or dizenzo, no grayscale conversion\n");
+	printf("  -s, --stream       read a sequence of images from a stream (stdin, pipe) and write P5 frames\n");
+	printf("  -i, --incremental[=TILE]  with --stream, recompute only the tiles that changed since the previous frame\n");
+	printf("  -r, --region=X,Y,W,H  compute only this region, may be repeated; regions go to TARGET.1, TARGET.2...\n");
+	printf("  -x, --index[=PATH]  use (or build) a row index of an ASCII source, SOURCE.idx by default\n");
+	printf("  -p, --pyramid=N[,FILTER]  sobel on N levels of a pyramid reduced with box (default) or gaussian\n");
+	printf("                            filter, level L goes to TARGET.L\n");
+	printf("  -l, --level=L      with --pyramid, write only level L, to TARGET\n");
+	printf("  -d, --downscale=F  reduce the image F times while decoding it, for previews and thumbnails\n");
+	printf("  -t, --threshold=T  write a P4 black and white image of the magnitudes above T, or use otsu to find T\n");
+	printf("  -o, --morphology=OPS  with --threshold, run dilate, erode, open or close, each as OP[:RADIUS], on\n");
+	printf("                        the black and white image, in the given order, before writing it\n");
+	printf("  -e, --edges=CUTOFF  write a sparse edge map of the magnitudes above CUTOFF\n");
+	printf("  -E, --expand       read an edge map from SOURCE and write it to TARGET as a P2 image\n");
+	printf("  -M, --median=SIZE  remove salt-and-pepper noise with a 3x3 or 5x5 median filter before sobel\n");
+	printf("  -R, --ring=NAME[,SLOTS]  with --stream, publish the frames into a ring of SLOTS (default %d) frames\n",
+	       FRAME_RING_DEFAULT_SLOTS);
+	printf("                     in shared memory instead of writing them to a target\n");
+	printf("  -F, --from-ring    read the frames of the ring SOURCE until its producer finishes, write them to TARGET\n");
+	printf("  -D, --daemon=SOCKET  serve requests on a Unix domain socket until SIGINT or SIGTERM\n");
+	printf("  -m, --memory=MB    with --daemon, the memory the requests in flight may take, %d MB by default\n",
+	       DAEMON_DEFAULT_MEMORY_MB);
+}
+
+/*
+ * Runs the sobel operator over every frame of a multi-image stream. When the
+ * frames go to the standard output, main has already moved the log messages
+ * to the standard error and passes the original standard output as frames_fd.
+ * With a ring name the frames go to the frame ring instead of the target.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int run_stream(char *source, char *target, int frames_fd, char *ring_name, u_int32_t ring_slots, int grayscale_mode,
+               int threads, u_int32_t tile_size, u_int32_t median_radius) {
+	FILE *input = strcmp(source, "-") == 0 ? stdin : fopen(source, "r");
+	if (input == NULL) {
+		printf("<main>: could not open the source stream.\n");
+		return -1;
+	}
+
+	if (ring_name != NULL) {
+		int result = sobel_filter_stream_to_ring(input, ring_name, ring_slots, grayscale_mode, threads, tile_size,
+		                                         median_radius);
+		if (input != stdin) fclose(input);
+		return result;
+	}
+
+	FILE *output = frames_fd >= 0 ? fdopen(frames_fd, "w") : fopen(target, "w");
+	if (output == NULL) {
+		printf("<main>: could not open the target stream.\n");
+		return -1;
+	}
+
+	int result = sobel_filter_stream(input, output, grayscale_mode, NETPBM_BINARY, threads, tile_size, median_radius);
+
+	if (input != stdin) fclose(input);
+	fclose(output);
+
+	return result;
+}
+
+/*
+ * Writes the frames of a frame ring to the target stream, or to frames_fd
+ * for the standard output as in run_stream.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int run_from_ring(char *ring_name, char *target, int frames_fd) {
+	FILE *output = frames_fd >= 0 ? fdopen(frames_fd, "w") : fopen(target, "w");
+	if (output == NULL) {
+		printf("<main>: could not open the target stream.\n");
+		return -1;
+	}
+
+	int result = write_frame_ring_stream(ring_name, output, NETPBM_BINARY);
+	fclose(output);
+
+	return result;
+}
+
+/*
+ * Computes sobel only in the given regions. Binary images are mapped into
+ * memory so that only the rows of the regions are read, ASCII images have to
+ * be read in full, unless there is an index: then only the rows covering the
+ * regions are parsed. A single region is written to the target path,
+ * otherwise region i is written to "target.i".
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int run_regions(char *source, char *target, struct sobel_region *regions, u_int32_t count, struct pnm_index *index,
+                int grayscale_mode, int threads) {
+	struct grayscale_image **results;
+
+	struct mapped_image *mapped = index == NULL ? open_mapped_image(source) : NULL;
+	if (mapped != NULL) {
+		results = sobel_filter_mapped_regions(mapped, regions, count, grayscale_mode, threads);
+		free_mapped_image(mapped);
+	} else if (index != NULL) {
+		// the rows of the regions together with one row above and below
+		u_int32_t y_from = index->height, y_to = 0;
+		for (u_int32_t i = 0; i < count; i++) {
+			u_int32_t from = regions[i].y > 0 ? regions[i].y - 1 : 0;
+			u_int32_t to = regions[i].y + regions[i].height + 1 < index->height ? regions[i].y + regions[i].height + 1 : index->height;
+			if (from < y_from) y_from = from;
+			if (to > y_to) y_to = to;
+		}
+
+		struct grayscale_image *rows = read_indexed_rows(source, index, y_from, y_to, grayscale_mode, threads);
+		if (rows == NULL) return -1;
+
+		// the regions are moved along with the rows
+		for (u_int32_t i = 0; i < count; i++) regions[i].y -= y_from;
+		results = sobel_filter_regions(rows, regions, count, threads);
+		for (u_int32_t i = 0; i < count; i++) regions[i].y += y_from;
+
+		free_grayscale_image(rows);
+	} else {
+		printf("<note>: could not map the image => reading all of it.\n");
+		struct grayscale_image *image = open_image_as_grayscale(source, grayscale_mode, 1);
+		if (image == NULL) return -1;
+
+		results = sobel_filter_regions(image, regions, count, threads);
+		free_grayscale_image(image);
+	}
+	if (results == NULL) return -1;
+
+	char *path = (char *) malloc(strlen(target) + 16);
+	for (u_int32_t i = 0; i < count; i++) {
+		if (count == 1) strcpy(path, target);
+		else sprintf(path, "%s.%u", target, i + 1);
+
+		write_grayscale_image(path, results[i], NETPBM_ASCII);
+		free_grayscale_image(results[i]);
+	}
+
+	free(path);
+	free(results);
+
+	return 0;
+}
+
+/*
+ * Reads the edge map at the source path and writes it out as a full image.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int run_expand(char *source, char *target) {
+	struct edge_map *map = open_edge_map(source);
+	if (map == NULL) return -1;
+
+	struct grayscale_image *image = edge_map_to_grayscale(map);
+	free_edge_map(map);
+
+	int result = write_grayscale_image(target, image, NETPBM_ASCII);
+	free_grayscale_image(image);
+
+	return result;
+}
+
+/*
+ * Builds a pyramid out of the image, applies sobel to all its levels and writes
+ * either the selected level to the target path, or level i to "target.i".
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int run_pyramid(struct grayscale_image *image, char *target, u_int32_t levels, int filter, int level, int threads) {
+	struct grayscale_pyramid *pyramid = build_grayscale_pyramid(image, levels, filter, threads);
+	if (pyramid == NULL) return -1;
+
+	struct grayscale_pyramid *sobel = sobel_filter_pyramid(pyramid, threads);
+	free_grayscale_pyramid(pyramid);
+	if (sobel == NULL) return -1;
+
+	if (level >= (int) sobel->count) {
+		printf("<main>: the pyramid has only %u levels.\n", sobel->count);
+		free_grayscale_pyramid(sobel);
+		return -1;
+	}
+
+	if (level >= 0) {
+		write_grayscale_image(target, &sobel->levels[level], NETPBM_ASCII);
+	} else {
+		char *path = (char *) malloc(strlen(target) + 16);
+		for (u_int32_t i = 0; i < sobel->count; i++) {
+			sprintf(path, "%s.%u", target, i);
+			write_grayscale_image(path, &sobel->levels[i], NETPBM_ASCII);
+		}
+		free(path);
+	}
+
+	free_grayscale_pyramid(sobel);
+
+	return 0;
+}
+
+/*
+ * Finds out how many pixels the sobel operator is going to go through, reading
+ * only the header of the source. Streams are assumed to be large.
+ *
+ * Returns the number of pixels, UINT64_MAX if it cannot be known in advance.
+ */
+u_int64_t get_work_pixels(char *source, int stream, struct sobel_region *regions, u_int32_t count, u_int32_t downscale) {
+	if (stream) return UINT64_MAX;
+
+	if (count > 0) {
+		u_int64_t pixels = 0;
+		for (u_int32_t i = 0; i < count; i++) pixels += (u_int64_t) regions[i].width * regions[i].height;
+		return pixels;
+	}
+
+	FILE *input = fopen(source, "r");
+	if (input == NULL) return UINT64_MAX;
+
+	struct image_file *file = open_image_stream(input);
+	fclose(input);
+	if (file == NULL) return UINT64_MAX;
+
+	u_int64_t pixels = ((u_int64_t) file->width * file->height) / ((u_int64_t) downscale * downscale);
+	free(file);
+
+	return pixels;
+}
+
 double get_timestamp(struct timeval from, struct timeval to) {
 	double timestamp = (to.tv_sec - from.tv_sec);
 	if (to.tv_usec < from.tv_usec) {
@@ -15,20 +303,295 @@ double get_timestamp(struct timeval from, struct timeval to) {
 }
 
 int main(int argc, char **argv) {
-	if (argc < 3) {
-		printf("Usage: <source path> <target path> <# of threads>\n");
+	// options and their default values
+	int grayscale_mode = GRAYSCALE_AVERAGE;
+	int color_mode = 0;
+	int stream = 0;
+	u_int32_t tile_size = 0;
+	int default_tile_size = 0;
+	struct sobel_region *regions = NULL;
+	u_int32_t region_count = 0;
+	char *index_path = NULL;
+	int use_index = 0;
+	u_int32_t pyramid_levels = 0;
+	int pyramid_filter = PYRAMID_BOX;
+	int pyramid_level = -1;
+	u_int32_t downscale = 1;
+	int threshold = 0;
+	int use_threshold = 0;
+	int edge_cutoff = -1;
+	int expand = 0;
+	char *daemon_path = NULL;
+	char *ring_name = NULL;
+	u_int32_t ring_slots = 0;
+	int from_ring = 0;
+	u_int32_t median_radius = 0;
+	struct morphology_stage *morphology_stages = NULL;
+	u_int32_t morphology_count = 0;
+	u_int64_t memory_limit = (u_int64_t) DAEMON_DEFAULT_MEMORY_MB << 20;
+
+	int option;
+	while ((option = getopt_long(argc, argv, "g:c:si::r:x::p:l:d:t:e:ED:m:M:R:Fo:", long_options, NULL)) != -1) {
+		switch (option) {
+			case 'g':
+				grayscale_mode = get_grayscale_mode(optarg);
+				if (grayscale_mode == -1) {
+					printf("<main>: unknown grayscale mode \"%s\".\n", optarg);
+					return -1;
+				}
+				break;
+			case 'c':
+				color_mode = get_sobel_color_mode(optarg);
+				if (color_mode == -1) {
+					printf("<main>: unknown color sobel mode \"%s\".\n", optarg);
+					return -1;
+				}
+				break;
+			case 's':
+				stream = 1;
+				break;
+			case 'i':
+				tile_size = optarg != NULL ? atoi(optarg) : INCREMENTAL_DEFAULT_TILE_SIZE;
+				default_tile_size = optarg == NULL;
+				if (tile_size == 0) {
+					printf("<main>: incorrect tile size \"%s\".\n", optarg);
+					return -1;
+				}
+				break;
+			case 'r':
+				regions = (struct sobel_region *) realloc(regions, (region_count + 1) * sizeof(struct sobel_region));
+				if (parse_sobel_region(optarg, &regions[region_count]) != 0) {
+					printf("<main>: incorrect region \"%s\", expected X,Y,W,H.\n", optarg);
+					return -1;
+				}
+				region_count++;
+				break;
+			case 'x':
+				use_index = 1;
+				index_path = optarg;
+				break;
+			case 'p': {
+				char *end;
+				long levels = strtol(optarg, &end, 10);
+				if (*end == ',') pyramid_filter = get_pyramid_filter(end + 1);
+				else if (*end != '\0') pyramid_filter = -1;
+				if (end == optarg || levels < 1 || levels > PYRAMID_MAX_LEVELS || pyramid_filter == -1) {
+					printf("<main>: incorrect pyramid \"%s\", expected N[,box|gaussian] with 1 to %d levels.\n", optarg,
+					       PYRAMID_MAX_LEVELS);
+					return -1;
+				}
+				pyramid_levels = levels;
+				break;
+			}
+			case 'l': {
+				char *end;
+				long level = strtol(optarg, &end, 10);
+				if (end == optarg || *end != '\0' || level < 0 || level >= PYRAMID_MAX_LEVELS) {
+					printf("<main>: incorrect pyramid level \"%s\".\n", optarg);
+					return -1;
+				}
+				pyramid_level = level;
+				break;
+			}
+			case 'd':
+				downscale = atoi(optarg);
+				if (downscale == 0 || downscale > DOWNSCALE_MAX_FACTOR) {
+					printf("<main>: incorrect downscale factor \"%s\", expected 1 to %d.\n", optarg, DOWNSCALE_MAX_FACTOR);
+					return -1;
+				}
+				break;
+			case 't':
+				if (parse_threshold(optarg, &threshold) != 0) {
+					printf("<main>: incorrect threshold \"%s\", expected a number or otsu.\n", optarg);
+					return -1;
+				}
+				use_threshold = 1;
+				break;
+			case 'e': {
+				char *end;
+				long cutoff = strtol(optarg, &end, 10);
+				if (end == optarg || *end != '\0' || cutoff < 0 || cutoff > 65535) {
+					printf("<main>: incorrect edge cutoff \"%s\", expected 0 to 65535.\n", optarg);
+					return -1;
+				}
+				edge_cutoff = cutoff;
+				break;
+			}
+			case 'E':
+				expand = 1;
+				break;
+			case 'D':
+				daemon_path = optarg;
+				break;
+			case 'm': {
+				char *end;
+				unsigned long long megabytes = strtoull(optarg, &end, 10);
+				if (end == optarg || *end != '\0' || optarg[0] == '-' || megabytes < 1 || megabytes > DAEMON_MAX_MEMORY_MB) {
+					printf("<main>: incorrect memory limit \"%s\", expected 1 to %d MB.\n", optarg, DAEMON_MAX_MEMORY_MB);
+					return -1;
+				}
+				memory_limit = (u_int64_t) megabytes << 20;
+				break;
+			}
+			case 'M':
+				if (parse_median_size(optarg, &median_radius) != 0) {
+					printf("<main>: incorrect median size \"%s\", expected 3 or 5.\n", optarg);
+					return -1;
+				}
+				break;
+			case 'R':
+				if (parse_frame_ring(optarg, &ring_name, &ring_slots) != 0) {
+					printf("<main>: incorrect ring \"%s\", expected NAME[,SLOTS] with at least two slots.\n", optarg);
+					return -1;
+				}
+				break;
+			case 'F':
+				from_ring = 1;
+				break;
+			case 'o':
+				free(morphology_stages);
+				if (parse_morphology_stages(optarg, &morphology_stages, &morphology_count) != 0) {
+					printf("<main>: incorrect morphology \"%s\", expected dilate, erode, open or close, each as OP[:RADIUS].\n",
+					       optarg);
+					return -1;
+				}
+				break;
+			default:
+				print_usage();
+				return -1;
+		}
+	}
+
+	// the daemon takes only the number of threads, the images come with the requests
+	if (daemon_path != NULL) {
+		int threads = 1;
+		if (argc - optind > 0 && parse_threads(argv[optind], &threads) != 0) {
+			printf("<main>: incorrect number of threads \"%s\", expected a positive number.\n", argv[optind]);
+			return -1;
+		}
+		printf("<note>: using the %s kernels.\n", select_kernel_tier());
+		return run_sobel_daemon(daemon_path, grayscale_mode, threads, memory_limit);
+	}
+
+	if (ring_name != NULL && !stream) {
+		printf("<note>: only streams can be published into a ring => ignoring it.\n");
+		ring_name = NULL;
+	}
+
+	// frames published into a ring have no target path
+	int paths = ring_name != NULL ? 1 : 2;
+	if (argc - optind < paths) {
+		print_usage();
 		return 0;
 	}
 
 	// file paths
-	char *source = argv[1];
-	char *target = argv[2];
+	char *source = argv[optind];
+	char *target = paths > 1 ? argv[optind + 1] : NULL;
+
+	// frames going to the standard output must not be mixed with the log
+	// messages, so those go to the standard error before anything is printed
+	int frames_fd = -1;
+	if ((stream || from_ring) && target != NULL && strcmp(target, "-") == 0) {
+		frames_fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+
+	// bind the kernels to the instruction set of this processor
+	const char *tier = select_kernel_tier();
+	printf("<note>: using the %s kernels.\n", tier);
 
 	// find out how many threads to use
-	int threads = 0;
-	if (argc < 4) printf("<note>: number of threads to use was not specified => using one thread.\n");
-	else threads = atoi(argv[3]);
-	if (threads == 0) threads = 1;
+	int threads = 1;
+	int auto_threads = 0;
+	if (argc - optind < paths + 1) {
+		printf("<note>: number of threads to use was not specified => using one thread.\n");
+	} else if (strcmp(argv[optind + paths], "auto") == 0) {
+		auto_threads = 1;
+	} else if (parse_threads(argv[optind + paths], &threads) != 0) {
+		printf("<main>: incorrect number of threads \"%s\", expected a positive number or auto.\n", argv[optind + paths]);
+		return -1;
+	}
+
+	// neither of these runs the sobel operator, so there is nothing to tune
+	if (expand) return run_expand(source, target);
+	if (from_ring) return run_from_ring(source, target, frames_fd);
+
+	if (downscale > 1 && (stream || region_count > 0 || color_mode != 0 || use_index)) {
+		printf("<note>: downscaling works only on whole grayscale images => ignoring it.\n");
+		downscale = 1;
+	}
+
+	if (pyramid_level >= 0 && pyramid_levels == 0) {
+		printf("<note>: a level is chosen only out of a pyramid => ignoring it.\n");
+		pyramid_level = -1;
+	}
+
+	if ((use_threshold || edge_cutoff >= 0) && (stream || region_count > 0 || pyramid_levels > 0)) {
+		printf("<note>: thresholding and edge maps work only on whole images => ignoring them.\n");
+		use_threshold = 0;
+		edge_cutoff = -1;
+	}
+
+	if (use_threshold && edge_cutoff >= 0) {
+		printf("<note>: an edge map is not binarized => ignoring the threshold.\n");
+		use_threshold = 0;
+	}
+
+	if (morphology_count > 0 && !use_threshold) {
+		printf("<note>: the morphology works only on thresholded images => ignoring it.\n");
+		morphology_count = 0;
+	}
+
+	if (median_radius > 0 && (region_count > 0 || (color_mode != 0 && !stream))) {
+		printf("<note>: the median filter works only on whole grayscale images => ignoring it.\n");
+		median_radius = 0;
+	}
+
+	if (median_radius > 0 && tile_size > 0) {
+		printf("<note>: the incremental sobel compares the frames before denoising => computing every frame in full.\n");
+		tile_size = 0;
+	}
+
+	// let the tuning of this host decide, for the size of this image once the options are settled
+	if (auto_threads) {
+		char *path = get_tuning_path();
+		struct sobel_tuning *tuning = get_sobel_tuning(path, tier);
+		free(path);
+
+		int tuned_tile_size = default_tile_size && tile_size > 0;
+		threads = get_tuned_threads(tuning, get_work_pixels(source, stream, regions, region_count, downscale));
+		if (tuned_tile_size) tile_size = tuning->tile_size;
+		printf("<note>: tuned for this host => using %d threads%s.\n", threads, tuned_tile_size ? " and the tuned tile size" : "");
+		free(tuning);
+	}
+
+	if (stream) {
+		if (color_mode != 0) printf("<note>: color sobel is not available for streams => using grayscale.\n");
+		return run_stream(source, target, frames_fd, ring_name, ring_slots, grayscale_mode, threads, tile_size,
+		                  median_radius);
+	}
+
+	// the index is only worth it for ASCII images
+	struct pnm_index *index = NULL;
+	if (use_index) {
+		char *path = index_path;
+		if (path == NULL) {
+			path = (char *) malloc(strlen(source) + 5);
+			sprintf(path, "%s.idx", source);
+		}
+
+		index = get_pnm_index(source, path, threads);
+		if (index == NULL) printf("<note>: could not use an index for \"%s\" => reading without it.\n", source);
+		if (path != index_path) free(path);
+	}
+
+	if (region_count > 0) {
+		int result = run_regions(source, target, regions, region_count, index, grayscale_mode, threads);
+		free(regions);
+		if (index != NULL) free_pnm_index(index);
+		return result;
+	}
 
 	// timer structures
 	struct timeval sobel_start_time, sobel_stop_time, overall_start_time, overall_stop_time;
@@ -36,22 +599,72 @@ int main(int argc, char **argv) {
 	// set the overall program timer
 	gettimeofday(&overall_start_time, NULL);
 
-	// open the image
-	struct rgb_image *image = open_rgb_image(source);
-	if (image == NULL) return -1;
+	// open the image, converting it to grayscale on the fly unless the color channels are needed
+	struct rgb_image *color_image = NULL;
+	struct grayscale_image *image = NULL;
+	if (color_mode != 0) color_image = open_rgb_image(source);
+	else if (index != NULL) image = read_indexed_rows(source, index, 0, index->height, grayscale_mode, threads);
+	else image = open_image_as_grayscale(source, grayscale_mode, downscale);
+	if (index != NULL) free_pnm_index(index);
+	if (image == NULL && color_image == NULL) return -1;
 
 	// set the sobel operation timer
 	gettimeofday(&sobel_start_time, NULL);
 
-	// perform the sobel operation
-	struct grayscale_image *sobel = sobel_filter_rgb(image, threads);
-	if (sobel == NULL) return -1;
+	// the plain sobel denoises in the same pass, the other ones need the denoised image
+	int fused_median = median_radius > 0 && pyramid_levels == 0 && !use_threshold && edge_cutoff < 0;
+	if (median_radius > 0 && !fused_median && image != NULL) {
+		struct grayscale_image *denoised = median_filter_grayscale(image, median_radius, threads);
+		free_grayscale_image(image);
+		image = denoised;
+		if (image == NULL) return -1;
+	}
+
+	if (pyramid_levels > 0 && image != NULL) {
+		int result = run_pyramid(image, target, pyramid_levels, pyramid_filter, pyramid_level, threads);
+		free_grayscale_image(image);
+		return result;
+	}
+
+	// perform the sobel operation, binarizing or sparsifying the result in the same pass for the grayscale sobel
+	struct grayscale_image *sobel = NULL;
+	struct blackwhite_image *binary = NULL;
+	struct edge_map *edges = NULL;
+	if (color_mode != 0) sobel = sobel_filter_rgb_color(color_image, color_mode, threads);
+	else if (edge_cutoff >= 0) edges = sobel_filter_edge_map(image, edge_cutoff, threads);
+	else if (use_threshold) binary = sobel_filter_threshold(image, threshold, threads);
+	else if (fused_median) sobel = sobel_filter_median(image, median_radius, threads);
+	else sobel = sobel_filter_grayscale(image, threads);
+	if (sobel == NULL && binary == NULL && edges == NULL) return -1;
+
+	if (edge_cutoff >= 0 && sobel != NULL) {
+		edges = build_edge_map(sobel, edge_cutoff, threads);
+		free_grayscale_image(sobel);
+		sobel = NULL;
+	}
+
+	if (use_threshold && sobel != NULL) {
+		binary = threshold_grayscale_image(sobel, threshold, threads);
+		free_grayscale_image(sobel);
+		sobel = NULL;
+	}
+
+	// the morphology closes the gaps in the edges or removes the specks before the image is written
+	if (binary != NULL && morphology_count > 0
+	    && apply_morphology_stages(binary, morphology_stages, morphology_count, threads) != 0) {
+		free_blackwhite_image(binary);
+		if (image != NULL) free_grayscale_image(image);
+		return -1;
+	}
+	free(morphology_stages);
 
 	// stop the sobel timer
 	gettimeofday(&sobel_stop_time, NULL);
 
 	// write sobel image to disk
-	write_grayscale_image(target, sobel, NETPBM_ASCII);
+	if (edges != NULL) write_edge_map(target, edges);
+	else if (binary != NULL) write_blackwhite_image(target, binary, NETPBM_BINARY);
+	else write_grayscale_image(target, sobel, NETPBM_ASCII);
 
 	// stop the overall timer
 	gettimeofday(&overall_stop_time, NULL);
@@ -62,8 +675,11 @@ int main(int argc, char **argv) {
 	// calculate how much time the program has taken overall
 	double overall_time = get_timestamp(overall_start_time, overall_stop_time);
 
-	free_grayscale_image(sobel);
-	free_rgb_image(image);
+	if (sobel != NULL) free_grayscale_image(sobel);
+	if (binary != NULL) free_blackwhite_image(binary);
+	if (edges != NULL) free_edge_map(edges);
+	if (image != NULL) free_grayscale_image(image);
+	if (color_image != NULL) free_rgb_image(color_image);
 
 	// print it all
 	printf("-----------------------------------------\n\n");
@@ -0,0 +1,378 @@
+#include "daemon.h"
+#include "sobel.h"
+#include "threads.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/*
+ * Returns the time of a monotonic clock in seconds.
+ */
+static double _now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*
+ * Makes sure the buffer holds at least the given number of bytes,
+ * keeping it as it is if it already does.
+ */
+static void _grow_buffer(u_int8_t **buffer, size_t *size, size_t needed) {
+	if (needed <= *size) return;
+	free(*buffer);
+	*buffer = (u_int8_t *) malloc(needed);
+	*size = needed;
+}
+
+/*
+ * Frees the buffers of a connection, they are allocated again by the next request
+ */
+static void _release_buffers(struct daemon_buffers *buffers) {
+	free(buffers->request);
+	free(buffers->answer);
+	*buffers = (struct daemon_buffers) {};
+}
+
+/*
+ * Takes the memory of a request out of the budget of the daemon, waiting
+ * for the requests in flight to release theirs if there is not enough left.
+ *
+ * Returns -1 if the request would not fit even alone, otherwise returns 0.
+ */
+static int _reserve_memory(struct sobel_daemon *daemon, u_int64_t bytes) {
+	if (bytes > daemon->memory_limit) return -1;
+
+	pthread_mutex_lock(&daemon->lock);
+	while (daemon->memory_used + bytes > daemon->memory_limit) pthread_cond_wait(&daemon->released, &daemon->lock);
+	daemon->memory_used += bytes;
+	pthread_mutex_unlock(&daemon->lock);
+
+	return 0;
+}
+
+/*
+ * Gives the memory of a finished request back to the budget
+ */
+static void _release_memory(struct sobel_daemon *daemon, u_int64_t bytes) {
+	if (bytes == 0) return;
+
+	pthread_mutex_lock(&daemon->lock);
+	daemon->memory_used -= bytes;
+	pthread_cond_broadcast(&daemon->released);
+	pthread_mutex_unlock(&daemon->lock);
+}
+
+/*
+ * Reads the image of a request from a seekable stream of the given size and
+ * applies sobel to it. The header is read first, so that the memory of the
+ * request is known before anything is allocated for it: every pixel of the
+ * formats the daemon reads takes at least one byte of the stream, so an image
+ * of more pixels than size bytes is refused. Unless the request already holds
+ * a larger reservation in *reserved, which is then cut down to it, the memory
+ * is reserved here. The reason of a failure goes to *error.
+ *
+ * Returns NULL if error occurred, otherwise a pointer to the sobel image.
+ */
+static struct grayscale_image *_sobel_request_image(struct sobel_daemon *daemon, FILE *stream, u_int64_t size,
+                                                    u_int64_t extra, u_int64_t *reserved, const char **error) {
+	struct image_file *file = open_image_stream(stream);
+	if (file == NULL) {
+		*error = "not a netpbm image";
+		return NULL;
+	}
+	u_int64_t pixels = (u_int64_t) file->width * file->height;
+	int version = file->version;
+	free(file);
+
+	if (version != NETPBM_GRAYSCALE_ASCII && version != NETPBM_GRAYSCALE_BINARY && version != NETPBM_RGB_ASCII
+	    && version != NETPBM_RGB_BINARY) {
+		*error = "not a grayscale or color netpbm image";
+		return NULL;
+	}
+
+	if (pixels > size) {
+		*error = "the image is shorter than its header";
+		return NULL;
+	}
+
+	u_int64_t bytes = pixels * DAEMON_PIXEL_BYTES + extra;
+	if (*reserved >= bytes) {
+		_release_memory(daemon, *reserved - bytes);
+		*reserved = bytes;
+	} else if (_reserve_memory(daemon, bytes) != 0) {
+		*error = "the image is larger than the memory limit";
+		return NULL;
+	} else {
+		*reserved = bytes;
+	}
+
+	rewind(stream);
+	struct grayscale_image *image = read_grayscale_frame(stream, daemon->mode);
+	if (image == NULL) {
+		*error = "could not parse the image";
+		return NULL;
+	}
+
+	struct grayscale_image *sobel = sobel_filter_grayscale(image, daemon->threads);
+	free_grayscale_image(image);
+	if (sobel == NULL) *error = "could not apply sobel";
+
+	return sobel;
+}
+
+/*
+ * Reads a line of the request without its newline.
+ *
+ * Returns -1 if the connection has ended, otherwise returns 0.
+ */
+static int _read_request_line(FILE *input, char *line) {
+	if (fgets(line, DAEMON_LINE_SIZE, input) == NULL) return -1;
+	line[strcspn(line, "\n")] = '\0';
+	return 0;
+}
+
+/*
+ * Serves a PATH request, whose first line has already been read.
+ *
+ * Returns -1 if the connection has to be closed, otherwise returns 0.
+ */
+static int _serve_path_request(struct sobel_daemon *daemon, FILE *input, FILE *output, double start) {
+	char source[DAEMON_LINE_SIZE], target[DAEMON_LINE_SIZE];
+	if (_read_request_line(input, source) != 0 || _read_request_line(input, target) != 0) return -1;
+
+	FILE *stream = fopen(source, "r");
+	struct stat status;
+	if (stream == NULL || fstat(fileno(stream), &status) != 0) {
+		if (stream != NULL) fclose(stream);
+		fprintf(output, "ERROR could not open the source\n");
+		return 0;
+	}
+
+	u_int64_t reserved = 0;
+	const char *error = NULL;
+	struct grayscale_image *sobel = _sobel_request_image(daemon, stream, status.st_size, 0, &reserved, &error);
+	fclose(stream);
+
+	if (sobel != NULL && write_grayscale_image(target, sobel, NETPBM_ASCII) != 0) error = "could not write the target";
+	if (sobel != NULL) free_grayscale_image(sobel);
+	_release_memory(daemon, reserved);
+
+	if (error != NULL) fprintf(output, "ERROR %s\n", error);
+	else fprintf(output, "OK %lu %s\n", (u_int64_t) ((_now() - start) * 1e6), target);
+
+	return 0;
+}
+
+/*
+ * Serves a DATA request of the given size, whose first line has already been
+ * read. The image and the answer go through the buffers of the connection.
+ *
+ * Returns -1 if the connection has to be closed, otherwise returns 0.
+ */
+static int _serve_data_request(struct sobel_daemon *daemon, FILE *input, FILE *output, struct daemon_buffers *buffers,
+                               u_int64_t size, double start) {
+	// the request is held to the most its image can take before a byte of it is read,
+	// the bytes of a request that is too large are not even read
+	u_int64_t reserved = size + size * DAEMON_PIXEL_BYTES;
+	if (size == 0 || size > daemon->memory_limit / (1 + DAEMON_PIXEL_BYTES) || _reserve_memory(daemon, reserved) != 0) {
+		fprintf(output, "ERROR the image is larger than the memory limit\n");
+		return -1;
+	}
+
+	_grow_buffer(&buffers->request, &buffers->request_size, size);
+	if (fread(buffers->request, 1, size, input) != size) {
+		_release_buffers(buffers);
+		_release_memory(daemon, reserved);
+		return -1;
+	}
+
+	FILE *stream = fmemopen(buffers->request, size, "r");
+	const char *error = NULL;
+	struct grayscale_image *sobel = _sobel_request_image(daemon, stream, size, size, &reserved, &error);
+	fclose(stream);
+
+	size_t length = 0;
+	if (sobel != NULL) {
+		// the P5 answer is one byte per pixel after a short header
+		_grow_buffer(&buffers->answer, &buffers->answer_size, (size_t) sobel->width * sobel->height + 64);
+		FILE *answer = fmemopen(buffers->answer, buffers->answer_size, "w");
+		if (write_grayscale_frame(answer, sobel, NETPBM_BINARY) != 0 || fflush(answer) != 0) error = "could not encode the result";
+		length = ftell(answer);
+		fclose(answer);
+		free_grayscale_image(sobel);
+	}
+
+	if (error != NULL) {
+		fprintf(output, "ERROR %s\n", error);
+	} else {
+		fprintf(output, "OK %lu %zu\n", (u_int64_t) ((_now() - start) * 1e6), length);
+		fwrite(buffers->answer, 1, length, output);
+	}
+
+	// the buffers are not counted in the budget once the request is over, so only small ones are kept
+	if (buffers->request_size + buffers->answer_size > DAEMON_KEPT_BUFFERS_SIZE) _release_buffers(buffers);
+	_release_memory(daemon, reserved);
+
+	return 0;
+}
+
+/*
+ * Serves the requests of a client one after another until it disconnects,
+ * stays idle for too long or breaks the protocol.
+ */
+static void _serve_connection(struct sobel_daemon *daemon, int client_fd, struct daemon_buffers *buffers) {
+	FILE *input = fdopen(client_fd, "r");
+	FILE *output = fdopen(dup(client_fd), "w");
+	if (input == NULL || output == NULL) {
+		if (input != NULL) fclose(input);
+		else close(client_fd);
+		if (output != NULL) fclose(output);
+		return;
+	}
+
+	char line[DAEMON_LINE_SIZE];
+	while (_read_request_line(input, line) == 0) {
+		double start = _now();
+
+		int result;
+		u_int64_t size;
+		if (strcmp(line, DAEMON_PATH_REQUEST) == 0) {
+			result = _serve_path_request(daemon, input, output, start);
+		} else if (sscanf(line, DAEMON_DATA_REQUEST " %lu", &size) == 1) {
+			result = _serve_data_request(daemon, input, output, buffers, size, start);
+		} else {
+			fprintf(output, "ERROR unknown request\n");
+			result = -1;
+		}
+
+		int sent = fflush(output) == 0;
+
+		pthread_mutex_lock(&daemon->lock);
+		u_int64_t number = ++daemon->requests;
+		pthread_mutex_unlock(&daemon->lock);
+		printf("<daemon>: request %lu served in %.3f ms.\n", number, (_now() - start) * 1e3);
+
+		if (result != 0 || !sent) break;
+	}
+
+	fclose(input);
+	fclose(output);
+}
+
+/*
+ * A connection thread of the daemon. Accepts clients and serves them until
+ * the listening socket is shut down.
+ *
+ * Returns NULL.
+ */
+void *_daemon_connection_job(void *data) {
+	struct sobel_daemon *daemon = (struct sobel_daemon *) data;
+	struct daemon_buffers buffers = {};
+
+	while (1) {
+		int client_fd = accept(daemon->socket_fd, NULL, NULL);
+		if (client_fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break;
+		}
+
+		struct timeval timeout = {.tv_sec = DAEMON_IDLE_TIMEOUT};
+		setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		_serve_connection(daemon, client_fd, &buffers);
+	}
+
+	_release_buffers(&buffers);
+
+	return NULL;
+}
+
+/*
+ * Listens on a Unix domain socket and applies sobel to the images the clients
+ * send, on threads that stay alive between the requests. Runs until SIGINT
+ * or SIGTERM, then lets the connected clients finish and removes the socket.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int run_sobel_daemon(char *socket_path, int mode, int threads, u_int64_t memory_limit) {
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		printf("<daemon>: the socket path is too long.\n");
+		return -1;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	// a socket left behind by a daemon that did not stop cleanly
+	struct stat status;
+	if (stat(socket_path, &status) == 0 && S_ISSOCK(status.st_mode)) unlink(socket_path);
+
+	// PATH requests read and write files as the user of the daemon, so only that user may connect;
+	// the socket gets its mode when it is bound and no other thread is running yet
+	int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	mode_t mask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+	int bound = socket_fd >= 0 && bind(socket_fd, (struct sockaddr *) &address, sizeof(address)) == 0;
+	umask(mask);
+	if (!bound || listen(socket_fd, SOMAXCONN) != 0) {
+		printf("<daemon>: could not listen on \"%s\".\n", socket_path);
+		if (socket_fd >= 0) close(socket_fd);
+		return -1;
+	}
+
+	// only this thread waits for the signals that stop the daemon, a client
+	// that disconnects early must not stop it either
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// the log of a long-running process is read while it runs
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (threads > 1 && start_thread_pool(threads - 1) != 0) {
+		close(socket_fd);
+		unlink(socket_path);
+		return -1;
+	}
+
+	struct sobel_daemon daemon = {.socket_fd = socket_fd,
+		.mode = mode,
+		.threads = threads,
+		.memory_limit = memory_limit};
+	pthread_mutex_init(&daemon.lock, NULL);
+	pthread_cond_init(&daemon.released, NULL);
+
+	pthread_t connections[DAEMON_CONNECTIONS];
+	for (int i = 0; i < DAEMON_CONNECTIONS; i++) {
+		pthread_create(&connections[i], NULL, _daemon_connection_job, (void *) &daemon);
+	}
+
+	printf("<daemon>: listening on \"%s\" with %d threads and %lu MB for the requests in flight.\n",
+	       socket_path, threads, memory_limit >> 20);
+
+	int signal_number;
+	sigwait(&signals, &signal_number);
+	printf("<daemon>: stopping...\n");
+
+	// wakes up the connection threads waiting in accept
+	shutdown(socket_fd, SHUT_RDWR);
+	for (int i = 0; i < DAEMON_CONNECTIONS; i++) pthread_join(connections[i], NULL);
+
+	close(socket_fd);
+	unlink(socket_path);
+	stop_thread_pool();
+
+	pthread_mutex_destroy(&daemon.lock);
+	pthread_cond_destroy(&daemon.released);
+
+	printf("<daemon>: served %lu requests.\n", daemon.requests);
+
+	return 0;
+}
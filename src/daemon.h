@@ -0,0 +1,83 @@
+#ifndef OMP_DAEMON_H
+#define OMP_DAEMON_H
+
+#include "netpbm.h" // we are going to need image structures
+#include <pthread.h>
+
+/* DEFINES */
+
+/*
+ * The requests a client can send, one after another over the same connection:
+ *
+ *   PATH\n<source path>\n<target path>\n
+ *       the daemon reads the source and writes the sobel image to the target
+ *       path as a P2 image, then answers OK <microseconds> <target path>\n
+ *
+ *   DATA <size>\n<size bytes of a PNM image>
+ *       the daemon answers OK <microseconds> <size>\n<size bytes of a P5 image>
+ *
+ * The time is how long the request has taken in the daemon, from its first
+ * line to the answer. A request that fails is answered with ERROR <message>\n.
+ */
+#define DAEMON_PATH_REQUEST "PATH"
+#define DAEMON_DATA_REQUEST "DATA"
+#define DAEMON_LINE_SIZE 4096
+
+/*
+ * How many clients are served at once, the others wait to be accepted,
+ * and how long an idle client keeps its connection
+ */
+#define DAEMON_CONNECTIONS 8
+#define DAEMON_IDLE_TIMEOUT 30
+
+/*
+ * The memory a request takes for every pixel: the source and the sobel
+ * image, and one byte of the answer
+ */
+#define DAEMON_PIXEL_BYTES (2 * sizeof(u_int32_t) + 1)
+#define DAEMON_DEFAULT_MEMORY_MB 256
+#define DAEMON_MAX_MEMORY_MB (1 << 20) // a terabyte
+
+/*
+ * A connection keeps its buffers for the next request only while they take
+ * at most this many bytes together, the larger ones are freed with the
+ * memory of their request
+ */
+#define DAEMON_KEPT_BUFFERS_SIZE (1 << 20)
+
+/* STRUCTURES */
+
+/*
+ * Contains everything the connections of the daemon share. The requests in
+ * flight take memory_used out of memory_limit, a request that does not fit
+ * waits for the others to release theirs. A DATA request reserves the most
+ * its body can need before the body is read and gives the rest back once the
+ * header of the image tells its size.
+ */
+struct sobel_daemon {
+    int socket_fd;
+    int mode, threads;
+    u_int64_t memory_limit, memory_used;
+    u_int64_t requests; // number of requests so far
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+};
+
+/*
+ * Buffers a connection thread keeps from one request to the next, grown to
+ * the largest request it has seen as long as they stay small
+ */
+struct daemon_buffers {
+    u_int8_t *request, *answer;
+    size_t request_size, answer_size;
+};
+
+/* FUNCTIONS */
+
+/* Helpers */
+void *_daemon_connection_job(void *data);
+
+/* Serving */
+int run_sobel_daemon(char *socket_path, int mode, int threads, u_int64_t memory_limit);
+
+#endif // OMP_DAEMON_H
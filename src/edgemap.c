@@ -0,0 +1,250 @@
+#include "edgemap.h"
+#include "kernels.h"
+#include "threads.h"
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+ * Runs the threads over all the rows of the source, then concatenates
+ * the kept pixels of their bands in row order.
+ *
+ * Returns NULL in case of an error or a pointer to the edge_map structure.
+ */
+static struct edge_map *_build_edge_map(struct grayscale_image *image, u_int32_t cutoff, int sobel, int threads) {
+	if (threads < 1) {
+		printf("<edgemap>: number of threads cannot be less than one.\n");
+		return NULL;
+	}
+
+	if (image == NULL) {
+		printf("<edgemap>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct edge_map *map = (struct edge_map *) calloc(1, sizeof(struct edge_map));
+	map->width = image->width;
+	map->height = image->height;
+	map->scale = image->scale;
+	map->cutoff = cutoff;
+	map->rows = (u_int64_t *) calloc(image->height + 1, sizeof(u_int64_t));
+
+	struct edge_map_band *bands = (struct edge_map_band *) calloc(threads, sizeof(struct edge_map_band));
+	struct edge_map_task task = {.source_image = image, .sobel = sobel, .map = map, .bands = bands};
+	run_row_bands(image->height, threads, _build_edge_map_thread_job, (void *) &task);
+
+	// the counts of the rows become their offsets
+	for (u_int32_t y = 0; y < image->height; y++) map->rows[y + 1] += map->rows[y];
+	map->count = map->rows[image->height];
+
+	map->columns = (u_int32_t *) malloc(map->count * sizeof(u_int32_t) + 1);
+	map->magnitudes = (u_int16_t *) malloc(map->count * sizeof(u_int16_t) + 1);
+
+	// the bands cover the rows in order, so do their pixels
+	u_int64_t offset = 0;
+	for (int i = 0; i < threads; i++) {
+		memcpy(map->columns + offset, bands[i].columns, bands[i].count * sizeof(u_int32_t));
+		memcpy(map->magnitudes + offset, bands[i].magnitudes, bands[i].count * sizeof(u_int16_t));
+		offset += bands[i].count;
+		free(bands[i].columns);
+		free(bands[i].magnitudes);
+	}
+	free(bands);
+
+	return map;
+}
+
+/*
+ * Applies the sobel operator to the given grayscale image and keeps only the
+ * pixels with a magnitude above the cutoff, without allocating the full result.
+ *
+ * Returns NULL in case of an error or a pointer to the edge_map structure.
+ */
+struct edge_map *sobel_filter_edge_map(struct grayscale_image *image, u_int32_t cutoff, int threads) {
+	return _build_edge_map(image, cutoff, 1, threads);
+}
+
+/*
+ * Keeps only the pixels of an image of already calculated magnitudes
+ * (e.g. the result of the color sobel) that are above the cutoff.
+ *
+ * Returns NULL in case of an error or a pointer to the edge_map structure.
+ */
+struct edge_map *build_edge_map(struct grayscale_image *image, u_int32_t cutoff, int threads) {
+	return _build_edge_map(image, cutoff, 0, threads);
+}
+
+/*
+ * A helper function for building the edge map. Goes through the band of rows
+ * given in the row_band_task and appends the kept pixels to its own band.
+ *
+ * Returns NULL.
+ */
+void *_build_edge_map_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct edge_map_task *task = (struct edge_map_task *) band->context;
+	struct edge_map_band *kept = &task->bands[band->index];
+	struct grayscale_image *image = task->source_image;
+
+	int32_t *scratch = NULL;
+	u_int32_t *magnitudes = NULL;
+	if (task->sobel) {
+		scratch = (int32_t *) calloc(SOBEL_GRAYSCALE_SCRATCH(image->width), sizeof(int32_t));
+		magnitudes = (u_int32_t *) malloc(image->width * sizeof(u_int32_t));
+	}
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		u_int32_t *row = image->matrix[y];
+
+		if (task->sobel) {
+			u_int32_t *above = y > 0 ? image->matrix[y - 1] : NULL;
+			u_int32_t *below = y + 1 < image->height ? image->matrix[y + 1] : NULL;
+			kernel_sobel_grayscale_row(above, row, below, magnitudes,
+			                           0, image->width, image->width, image->scale, scratch);
+			row = magnitudes;
+		}
+
+		// make sure a whole row fits
+		if (kept->count + image->width > kept->capacity) {
+			kept->capacity = 2 * kept->capacity + image->width;
+			kept->columns = (u_int32_t *) realloc(kept->columns, kept->capacity * sizeof(u_int32_t));
+			kept->magnitudes = (u_int16_t *) realloc(kept->magnitudes, kept->capacity * sizeof(u_int16_t));
+		}
+
+		u_int64_t first = kept->count;
+		for (u_int32_t x = 0; x < image->width; x++) {
+			if (row[x] <= task->map->cutoff) continue;
+			kept->columns[kept->count] = x;
+			kept->magnitudes[kept->count] = (u_int16_t) row[x];
+			kept->count++;
+		}
+		task->map->rows[y + 1] = kept->count - first;
+	}
+
+	free(scratch);
+	free(magnitudes);
+
+	return NULL;
+}
+
+/*
+ * Saves the edge map to disk.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int write_edge_map(char *file_path, struct edge_map *map) {
+	printf("<edgemap>: writing the edge map to disk...\n");
+
+	FILE *stream = fopen(file_path, "wb");
+	if (stream == NULL) {
+		printf("<edgemap>: could not open file for writing.\n");
+		return -1;
+	}
+
+	u_int32_t format_version = EDGE_MAP_FORMAT_VERSION;
+	fwrite(EDGE_MAP_MAGIC, 1, 8, stream);
+	fwrite(&format_version, sizeof(u_int32_t), 1, stream);
+	fwrite(map, offsetof(struct edge_map, rows), 1, stream);
+	fwrite(map->rows, sizeof(u_int64_t), map->height + 1, stream);
+	fwrite(map->columns, sizeof(u_int32_t), map->count, stream);
+	fwrite(map->magnitudes, sizeof(u_int16_t), map->count, stream);
+
+	int failed = ferror(stream);
+	fclose(stream);
+
+	if (failed) {
+		printf("<edgemap>: could not write the edge map.\n");
+		return -1;
+	}
+
+	printf("<edgemap>: %" PRIu64 " of %" PRIu64 " pixels written in \"%s\"\n", map->count, (u_int64_t) map->width * map->height, file_path);
+
+	return 0;
+}
+
+/*
+ * Reads an edge map written by write_edge_map.
+ *
+ * Returns NULL in case of an error or a pointer to the edge_map structure.
+ */
+struct edge_map *open_edge_map(char *file_path) {
+	FILE *stream = fopen(file_path, "rb");
+	if (stream == NULL) {
+		printf("<edgemap>: could not open edge map file.\n");
+		return NULL;
+	}
+
+	char magic[8];
+	u_int32_t format_version;
+	struct edge_map *map = (struct edge_map *) calloc(1, sizeof(struct edge_map));
+
+	int correct = fread(magic, 1, 8, stream) == 8 && memcmp(magic, EDGE_MAP_MAGIC, 8) == 0
+	              && fread(&format_version, sizeof(u_int32_t), 1, stream) == 1
+	              && format_version == EDGE_MAP_FORMAT_VERSION
+	              && fread(map, offsetof(struct edge_map, rows), 1, stream) == 1;
+	// the header must describe exactly the rest of the file before anything is allocated for it
+	if (correct) {
+		int64_t start = ftell(stream);
+		correct = start >= 0 && fseek(stream, 0, SEEK_END) == 0;
+		int64_t end = correct ? ftell(stream) : -1;
+		correct = correct && end >= start && fseek(stream, start, SEEK_SET) == 0;
+
+		u_int64_t rest = correct ? (u_int64_t) (end - start) : 0;
+		u_int64_t rows_size = ((u_int64_t) map->height + 1) * sizeof(u_int64_t);
+		correct = correct && map->count <= (u_int64_t) map->width * map->height && rows_size <= rest
+		          && map->count == (rest - rows_size) / (sizeof(u_int32_t) + sizeof(u_int16_t))
+		          && (rest - rows_size) % (sizeof(u_int32_t) + sizeof(u_int16_t)) == 0;
+	}
+	if (correct) {
+		size_t rows_count = (size_t) map->height + 1;
+		map->rows = (u_int64_t *) malloc(rows_count * sizeof(u_int64_t));
+		correct = map->rows != NULL && fread(map->rows, sizeof(u_int64_t), rows_count, stream) == rows_count
+		          && map->rows[0] == 0 && map->rows[map->height] == map->count;
+		for (u_int32_t y = 0; correct && y < map->height; y++) correct = map->rows[y] <= map->rows[y + 1];
+	}
+	if (correct) {
+		map->columns = (u_int32_t *) malloc((size_t) map->count * sizeof(u_int32_t) + 1);
+		map->magnitudes = (u_int16_t *) malloc((size_t) map->count * sizeof(u_int16_t) + 1);
+		correct = map->columns != NULL && map->magnitudes != NULL
+		          && fread(map->columns, sizeof(u_int32_t), map->count, stream) == map->count
+		          && fread(map->magnitudes, sizeof(u_int16_t), map->count, stream) == map->count;
+		for (u_int64_t i = 0; correct && i < map->count; i++) correct = map->columns[i] < map->width;
+	}
+	fclose(stream);
+
+	if (!correct) {
+		printf("<edgemap>: \"%s\" is not a correct edge map.\n", file_path);
+		free_edge_map(map);
+		return NULL;
+	}
+
+	return map;
+}
+
+/*
+ * Expands the edge map back into a full image, the pixels
+ * that were not kept become zeros.
+ *
+ * Returns a pointer to the grayscale_image structure.
+ */
+struct grayscale_image *edge_map_to_grayscale(struct edge_map *map) {
+	struct grayscale_image *image = create_grayscale_image(map->width, map->height, map->scale);
+
+	for (u_int32_t y = 0; y < map->height; y++) {
+		for (u_int64_t i = map->rows[y]; i < map->rows[y + 1]; i++) {
+			image->matrix[y][map->columns[i]] = map->magnitudes[i];
+		}
+	}
+
+	return image;
+}
+
+/*
+ * Completely frees the allocated memory for the edge map
+ */
+void free_edge_map(struct edge_map *map) {
+	free(map->rows);
+	free(map->columns);
+	free(map->magnitudes);
+	free(map);
+}
@@ -0,0 +1,69 @@
+#ifndef OMP_EDGEMAP_H
+#define OMP_EDGEMAP_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* DEFINES */
+
+#define EDGE_MAP_MAGIC "EDGEMAP\0"
+#define EDGE_MAP_FORMAT_VERSION 1
+
+/* STRUCTURES */
+
+/*
+ * A sparse edge map: only the pixels with a magnitude above the cutoff are
+ * kept, row by row (compressed sparse rows). The pixels of row y are the
+ * entries [rows[y], rows[y + 1]) of the columns and magnitudes arrays.
+ * On disk the fields up to rows follow the magic and the format version,
+ * then go the three arrays.
+ */
+struct edge_map {
+    u_int32_t width;
+    u_int32_t height;
+    u_int32_t scale;
+    u_int32_t cutoff;
+    u_int64_t count; // number of kept pixels
+    u_int64_t *rows; // height + 1 offsets
+    u_int32_t *columns;
+    u_int16_t *magnitudes;
+};
+
+/*
+ * The pixels one thread has kept in its band of rows, in row order
+ */
+struct edge_map_band {
+    u_int64_t count, capacity;
+    u_int32_t *columns;
+    u_int16_t *magnitudes;
+};
+
+/*
+ * Contains the data shared by the threads building an edge map. Every row of
+ * the source goes through the sobel operator first if sobel is set, the kept
+ * pixels go to the band of the thread and the number of them to rows[y + 1].
+ */
+struct edge_map_task {
+    struct grayscale_image *source_image;
+    int sobel;
+    struct edge_map *map;
+    struct edge_map_band *bands;
+};
+
+/* FUNCTIONS */
+
+/* Helpers */
+void *_build_edge_map_thread_job(void *data);
+
+/* Building */
+struct edge_map *sobel_filter_edge_map(struct grayscale_image *image, u_int32_t cutoff, int threads);
+struct edge_map *build_edge_map(struct grayscale_image *image, u_int32_t cutoff, int threads);
+
+/* Reading and writing */
+int write_edge_map(char *file_path, struct edge_map *map);
+struct edge_map *open_edge_map(char *file_path);
+struct grayscale_image *edge_map_to_grayscale(struct edge_map *map);
+
+/* Memory */
+void free_edge_map(struct edge_map *map);
+
+#endif // OMP_EDGEMAP_H
@@ -0,0 +1,184 @@
+#include "incremental.h"
+#include "kernels.h"
+#include "threads.h"
+
+/*
+ * Allocates the state for a new sequence of frames, the tiles are
+ * tile_size x tile_size pixels. Nothing is known about the frames yet,
+ * so the first frame is always computed in full.
+ *
+ * Returns a pointer to the sobel_incremental structure.
+ */
+struct sobel_incremental *create_sobel_incremental(u_int32_t tile_size, int threads) {
+	struct sobel_incremental *context = (struct sobel_incremental *) calloc(1, sizeof(struct sobel_incremental));
+	context->tile_size = tile_size > 0 ? tile_size : INCREMENTAL_DEFAULT_TILE_SIZE;
+	context->threads = threads;
+
+	return context;
+}
+
+/*
+ * Completely frees the state, including the last frame and its sobel image
+ */
+void free_sobel_incremental(struct sobel_incremental *context) {
+	if (context->previous != NULL) free_grayscale_image(context->previous);
+	if (context->output != NULL) free_grayscale_image(context->output);
+	free(context->changed);
+	free(context);
+}
+
+/*
+ * Forgets the previous frame and prepares the state for frames of the size
+ * of the given one, with every tile marked as changed.
+ */
+static void _reset_sobel_incremental(struct sobel_incremental *context, struct grayscale_image *frame) {
+	if (context->previous != NULL) free_grayscale_image(context->previous);
+	if (context->output != NULL) free_grayscale_image(context->output);
+	free(context->changed);
+
+	context->previous = NULL;
+	context->output = create_grayscale_image(frame->width, frame->height, frame->scale);
+	context->tiles_x = (frame->width + context->tile_size - 1) / context->tile_size;
+	context->tiles_y = (frame->height + context->tile_size - 1) / context->tile_size;
+	context->changed = (u_int8_t *) malloc(context->tiles_x * context->tiles_y * sizeof(u_int8_t));
+	memset(context->changed, 1, context->tiles_x * context->tiles_y * sizeof(u_int8_t));
+}
+
+/*
+ * Applies the sobel operator to the next frame of the sequence, recomputing
+ * only the tiles that differ from the previous frame together with a one pixel
+ * border around them, the rest of the previous sobel image is kept as it is.
+ * The result is the same as the one of sobel_filter_grayscale.
+ *
+ * The context takes over the frame, it is freed with the next frame. The
+ * returned image belongs to the context too and changes with the next frame.
+ *
+ * Returns NULL in case of an error or a pointer to the sobel image of the frame.
+ */
+struct grayscale_image *sobel_filter_incremental(struct sobel_incremental *context, struct grayscale_image *frame) {
+	if (frame == NULL) {
+		printf("<sobel>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct grayscale_image *previous = context->previous;
+	u_int64_t *computed = (u_int64_t *) calloc(context->threads, sizeof(u_int64_t));
+	struct sobel_incremental_task task = {.context = context, .frame = frame, .computed = computed};
+
+	// compare the frame with the previous one, unless there is nothing to compare with
+	if (previous == NULL || previous->width != frame->width || previous->height != frame->height
+	    || previous->scale != frame->scale) {
+		_reset_sobel_incremental(context, frame);
+	} else {
+		run_row_bands(context->tiles_y, context->threads, _find_changed_tiles_thread_job, (void *) &task);
+	}
+
+	run_row_bands(frame->height, context->threads, _sobel_incremental_thread_job, (void *) &task);
+
+	// keep the statistics
+	context->frame_pixels = (u_int64_t) frame->width * frame->height;
+	context->frame_computed = 0;
+	for (int i = 0; i < context->threads; i++) context->frame_computed += computed[i];
+	context->total_pixels += context->frame_pixels;
+	context->total_computed += context->frame_computed;
+	free(computed);
+
+	// the frame becomes the one to compare the next frame with
+	if (context->previous != NULL) free_grayscale_image(context->previous);
+	context->previous = frame;
+
+	return context->output;
+}
+
+/*
+ * Finds the part of the work that was skipped over all the frames so far.
+ *
+ * Returns the skipped fraction of pixels, 0..1.
+ */
+double sobel_incremental_skipped(struct sobel_incremental *context) {
+	if (context->total_pixels == 0) return 0;
+	return 1.0 - (double) context->total_computed / (double) context->total_pixels;
+}
+
+/*
+ * A helper function for the incremental sobel. Compares the band of tile rows
+ * given in the row_band_task with the previous frame, a row of pixels at a time,
+ * and marks the tiles that differ.
+ *
+ * Returns NULL.
+ */
+void *_find_changed_tiles_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct sobel_incremental_task *task = (struct sobel_incremental_task *) band->context;
+	struct sobel_incremental *context = task->context;
+	struct grayscale_image *frame = task->frame;
+	u_int32_t size = context->tile_size;
+
+	for (u_int32_t ty = band->from; ty < band->to; ty++) {
+		u_int8_t *changed = context->changed + ty * context->tiles_x;
+		memset(changed, 0, context->tiles_x * sizeof(u_int8_t));
+
+		u_int32_t y_to = (ty + 1) * size < frame->height ? (ty + 1) * size : frame->height;
+		for (u_int32_t y = ty * size; y < y_to; y++) {
+			for (u_int32_t tx = 0; tx < context->tiles_x; tx++) {
+				if (changed[tx]) continue; // no need to look any further
+
+				u_int32_t x = tx * size;
+				u_int32_t count = x + size < frame->width ? size : frame->width - x;
+				changed[tx] = kernel_rows_differ(context->previous->matrix[y] + x, frame->matrix[y] + x, count);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * A helper function for the incremental sobel. For every row of the band
+ * finds the columns that are within one pixel of a changed tile and
+ * recomputes sobel there only.
+ *
+ * Returns NULL.
+ */
+void *_sobel_incremental_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct sobel_incremental_task *task = (struct sobel_incremental_task *) band->context;
+	struct sobel_incremental *context = task->context;
+	struct grayscale_image *frame = task->frame;
+	u_int32_t size = context->tile_size;
+
+	int32_t *scratch = (int32_t *) calloc(SOBEL_GRAYSCALE_SCRATCH(frame->width), sizeof(int32_t));
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		// tile rows of this row and of its neighbours
+		u_int32_t ty_from = (y > 0 ? y - 1 : 0) / size;
+		u_int32_t ty_to = (y + 1) / size < context->tiles_y ? (y + 1) / size : context->tiles_y - 1;
+
+		u_int32_t *above = y > 0 ? frame->matrix[y - 1] : NULL;
+		u_int32_t *below = y + 1 < frame->height ? frame->matrix[y + 1] : NULL;
+
+		for (u_int32_t tx = 0; tx < context->tiles_x; tx++) {
+			// find a run of tile columns that touch a changed tile
+			u_int32_t run = tx;
+			for (; run < context->tiles_x; run++) {
+				int dirty = 0;
+				for (u_int32_t ty = ty_from; ty <= ty_to; ty++) dirty |= context->changed[ty * context->tiles_x + run];
+				if (!dirty) break;
+			}
+			if (run == tx) continue;
+
+			// the run plus one pixel on each side
+			u_int32_t x_from = tx * size > 0 ? tx * size - 1 : 0;
+			u_int32_t x_to = run * size + 1 < frame->width ? run * size + 1 : frame->width;
+			kernel_sobel_grayscale_row(above, frame->matrix[y], below, context->output->matrix[y],
+			                           x_from, x_to, frame->width, frame->scale, scratch);
+
+			task->computed[band->index] += x_to - x_from;
+			tx = run;
+		}
+	}
+
+	free(scratch);
+
+	return NULL;
+}
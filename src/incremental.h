@@ -0,0 +1,53 @@
+#ifndef OMP_INCREMENTAL_H
+#define OMP_INCREMENTAL_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* DEFINES */
+
+#define INCREMENTAL_DEFAULT_TILE_SIZE 32
+
+/* STRUCTURES */
+
+/*
+ * Keeps the state of the sobel operation over a sequence of frames of the
+ * same size: the previous frame, its sobel image and which tiles of the
+ * current frame differ from the previous one. Also counts how many pixels
+ * had to be computed, for the last frame and overall.
+ */
+struct sobel_incremental {
+    u_int32_t tile_size;
+    u_int32_t tiles_x, tiles_y;
+    u_int8_t *changed; // tiles_y rows of tiles_x flags
+    struct grayscale_image *previous;
+    struct grayscale_image *output;
+    int threads;
+    u_int64_t frame_pixels, frame_computed;
+    u_int64_t total_pixels, total_computed;
+};
+
+/*
+ * Contains the data shared by the threads of one incremental step,
+ * every thread counts the pixels it computed in its own slot.
+ */
+struct sobel_incremental_task {
+    struct sobel_incremental *context;
+    struct grayscale_image *frame;
+    u_int64_t *computed;
+};
+
+/* FUNCTIONS */
+
+/* Creating and memory allocation */
+struct sobel_incremental *create_sobel_incremental(u_int32_t tile_size, int threads);
+void free_sobel_incremental(struct sobel_incremental *context);
+
+/* Helpers */
+void *_find_changed_tiles_thread_job(void *data);
+void *_sobel_incremental_thread_job(void *data);
+
+/* Sobel operation */
+struct grayscale_image *sobel_filter_incremental(struct sobel_incremental *context, struct grayscale_image *frame);
+double sobel_incremental_skipped(struct sobel_incremental *context);
+
+#endif // OMP_INCREMENTAL_H
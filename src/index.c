@@ -0,0 +1,458 @@
+#include "index.h"
+#include "kernels.h"
+#include "threads.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/*
+ * Maps an ASCII image file into memory after reading its header.
+ *
+ * Returns NULL if error occurred, otherwise a pointer to the pnm_index_source structure.
+ */
+static struct pnm_index_source *_map_index_source(char *source_path) {
+	struct image_file *file = open_image_file(source_path);
+	if (file == NULL) return NULL;
+
+	if (file->version != NETPBM_GRAYSCALE_ASCII && file->version != NETPBM_RGB_ASCII) {
+		printf("<index>: only P2 and P3 images can be indexed.\n");
+		fclose(file->stream);
+		free(file);
+		return NULL;
+	}
+
+	struct stat file_stat;
+	fstat(fileno(file->stream), &file_stat);
+
+	struct pnm_index_source *source = (struct pnm_index_source *) malloc(sizeof(struct pnm_index_source));
+	*source = (struct pnm_index_source) {.header = *file,
+		.size = file_stat.st_size,
+		.body = ftell(file->stream),
+		.modified = (int64_t) file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec};
+	source->header.stream = NULL;
+
+	source->data = (char *) mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, fileno(file->stream), 0);
+
+	// the mapping stays valid after the file is closed
+	fclose(file->stream);
+	free(file);
+
+	if (source->data == MAP_FAILED) {
+		printf("<index>: could not map the image file.\n");
+		free(source);
+		return NULL;
+	}
+
+	return source;
+}
+
+/*
+ * Unmaps the file and frees the structure
+ */
+static void _unmap_index_source(struct pnm_index_source *source) {
+	munmap(source->data, source->size);
+	free(source);
+}
+
+/*
+ * Hashes one block of the source with FNV-1a.
+ *
+ * Returns the hash of the block.
+ */
+static u_int64_t _hash_block(struct pnm_index_source *source, u_int64_t block) {
+	u_int64_t from = block * PNM_INDEX_BLOCK_SIZE;
+	u_int64_t to = from + PNM_INDEX_BLOCK_SIZE < source->size ? from + PNM_INDEX_BLOCK_SIZE : source->size;
+
+	u_int64_t hash = FNV_OFFSET;
+	for (u_int64_t i = from; i < to; i++) hash = (hash ^ (u_int8_t) source->data[i]) * FNV_PRIME;
+
+	return hash;
+}
+
+/*
+ * Combines the hashes of the blocks, in order, into the checksum of the file.
+ *
+ * Returns the checksum.
+ */
+static u_int64_t _combine_hashes(u_int64_t *hashes, u_int64_t blocks) {
+	u_int64_t checksum = FNV_OFFSET;
+	for (u_int64_t i = 0; i < blocks; i++) {
+		for (int b = 0; b < 8; b++) checksum = (checksum ^ ((hashes[i] >> (8 * b)) & 0xff)) * FNV_PRIME;
+	}
+
+	return checksum;
+}
+
+/*
+ * Whether a sample starts at the given position of the source:
+ * a digit in the body that does not follow another digit.
+ */
+static inline int _sample_starts_at(struct pnm_index_source *source, u_int64_t i) {
+	char *data = source->data;
+	return i >= source->body && data[i] >= '0' && data[i] <= '9' && !(data[i - 1] >= '0' && data[i - 1] <= '9');
+}
+
+/*
+ * A helper function for the checksum. Hashes the band of blocks
+ * given in the row_band_task.
+ *
+ * Returns NULL.
+ */
+void *_hash_blocks_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct pnm_index_build_task *task = (struct pnm_index_build_task *) band->context;
+
+	for (u_int32_t block = band->from; block < band->to; block++) {
+		task->hashes[block] = _hash_block(task->source, block);
+	}
+
+	return NULL;
+}
+
+/*
+ * A helper function for building the index. Hashes the band of blocks
+ * given in the row_band_task and counts the samples starting in each of them.
+ *
+ * Returns NULL.
+ */
+void *_count_samples_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct pnm_index_build_task *task = (struct pnm_index_build_task *) band->context;
+	struct pnm_index_source *source = task->source;
+
+	for (u_int32_t block = band->from; block < band->to; block++) {
+		task->hashes[block] = _hash_block(source, block);
+
+		u_int64_t from = (u_int64_t) block * PNM_INDEX_BLOCK_SIZE;
+		u_int64_t to = from + PNM_INDEX_BLOCK_SIZE < source->size ? from + PNM_INDEX_BLOCK_SIZE : source->size;
+
+		u_int64_t samples = 0;
+		for (u_int64_t i = from; i < to; i++) samples += _sample_starts_at(source, i);
+		task->samples[block] = samples;
+	}
+
+	return NULL;
+}
+
+/*
+ * A helper function for building the index. Knowing how many samples come
+ * before each block, records the offsets of the indexed rows that start in
+ * the band of blocks given in the row_band_task.
+ *
+ * Returns NULL.
+ */
+void *_find_rows_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct pnm_index_build_task *task = (struct pnm_index_build_task *) band->context;
+	struct pnm_index_source *source = task->source;
+	struct pnm_index *index = task->index;
+
+	u_int64_t channels = index->version == NETPBM_RGB_ASCII ? 3 : 1;
+	u_int64_t samples_per_offset = (u_int64_t) index->stride * index->width * channels;
+
+	for (u_int32_t block = band->from; block < band->to; block++) {
+		u_int64_t from = (u_int64_t) block * PNM_INDEX_BLOCK_SIZE;
+		u_int64_t to = from + PNM_INDEX_BLOCK_SIZE < source->size ? from + PNM_INDEX_BLOCK_SIZE : source->size;
+
+		u_int64_t sample = task->samples[block];
+		for (u_int64_t i = from; i < to; i++) {
+			if (!_sample_starts_at(source, i)) continue;
+
+			if (sample % samples_per_offset == 0 && sample / samples_per_offset < index->count) {
+				index->offsets[sample / samples_per_offset] = i;
+			}
+			sample++;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Finds the checksum of the whole source file, the blocks are hashed in parallel.
+ *
+ * Returns the checksum.
+ */
+static u_int64_t _checksum_index_source(struct pnm_index_source *source, int threads) {
+	u_int64_t blocks = (source->size + PNM_INDEX_BLOCK_SIZE - 1) / PNM_INDEX_BLOCK_SIZE;
+	struct pnm_index_build_task task = {.source = source, .hashes = (u_int64_t *) malloc(blocks * sizeof(u_int64_t))};
+
+	run_row_bands(blocks, threads, _hash_blocks_thread_job, (void *) &task);
+	u_int64_t checksum = _combine_hashes(task.hashes, blocks);
+
+	free(task.hashes);
+
+	return checksum;
+}
+
+/*
+ * Builds an index of an ASCII image, recording the offset of every stride-th row.
+ * The file is mapped into memory and split into blocks between the threads: first
+ * every block is hashed and its samples are counted, then, knowing how many samples
+ * precede every block, the threads find the offsets of the rows in their blocks.
+ *
+ * Returns NULL if error occurred, otherwise a pointer to the pnm_index structure.
+ */
+struct pnm_index *build_pnm_index(char *source_path, u_int32_t stride, int threads) {
+	struct pnm_index_source *source = _map_index_source(source_path);
+	if (source == NULL) return NULL;
+
+	if (stride == 0) stride = PNM_INDEX_STRIDE;
+
+	struct pnm_index *index = (struct pnm_index *) malloc(sizeof(struct pnm_index));
+	*index = (struct pnm_index) {.version = source->header.version,
+		.width = source->header.width,
+		.height = source->header.height,
+		.scale = source->header.scale,
+		.stride = stride,
+		.count = (source->header.height + stride - 1) / stride,
+		.size = source->size,
+		.modified = source->modified};
+	index->offsets = (u_int64_t *) calloc(index->count, sizeof(u_int64_t));
+
+	u_int64_t blocks = (source->size + PNM_INDEX_BLOCK_SIZE - 1) / PNM_INDEX_BLOCK_SIZE;
+	struct pnm_index_build_task task = {
+		.source = source,
+		.index = index,
+		.hashes = (u_int64_t *) malloc(blocks * sizeof(u_int64_t)),
+		.samples = (u_int64_t *) malloc(blocks * sizeof(u_int64_t))};
+
+	run_row_bands(blocks, threads, _count_samples_thread_job, (void *) &task);
+
+	// turn the counts into the number of samples before each block
+	u_int64_t total = 0;
+	for (u_int64_t i = 0; i < blocks; i++) {
+		u_int64_t samples = task.samples[i];
+		task.samples[i] = total;
+		total += samples;
+	}
+
+	index->checksum = _combine_hashes(task.hashes, blocks);
+
+	u_int64_t channels = index->version == NETPBM_RGB_ASCII ? 3 : 1;
+	if (total < (u_int64_t) index->width * index->height * channels) {
+		printf("<index>: the image has fewer samples than its header says.\n");
+		free_pnm_index(index);
+		index = NULL;
+	} else {
+		run_row_bands(blocks, threads, _find_rows_thread_job, (void *) &task);
+	}
+
+	free(task.hashes);
+	free(task.samples);
+	_unmap_index_source(source);
+
+	return index;
+}
+
+/*
+ * Saves the index to disk: the fixed size fields, then the offsets.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int write_pnm_index(char *index_path, struct pnm_index *index) {
+	FILE *stream = fopen(index_path, "wb");
+	if (stream == NULL) {
+		printf("<index>: could not open file for writing.\n");
+		return -1;
+	}
+
+	u_int32_t format_version = PNM_INDEX_FORMAT_VERSION;
+	fwrite(PNM_INDEX_MAGIC, 1, 8, stream);
+	fwrite(&format_version, sizeof(u_int32_t), 1, stream);
+	fwrite(index, sizeof(struct pnm_index) - sizeof(u_int64_t *), 1, stream);
+	fwrite(index->offsets, sizeof(u_int64_t), index->count, stream);
+
+	int failed = ferror(stream);
+	fclose(stream);
+
+	if (failed) {
+		printf("<index>: could not write the index.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Loads the index of the source from disk and checks that it still describes
+ * the source: the header must be the same, the offsets must lie in order
+ * within the body of the source and its size must be the same, and if the
+ * file was modified since the index was built, its checksum must be the same
+ * too. Then the index is saved again with the new modification time, so that
+ * the source is not hashed on every use.
+ *
+ * Returns NULL if there is no usable index, otherwise a pointer to the pnm_index structure.
+ */
+struct pnm_index *load_pnm_index(char *source_path, char *index_path, int threads) {
+	FILE *stream = fopen(index_path, "rb");
+	if (stream == NULL) return NULL;
+
+	char magic[8];
+	u_int32_t format_version;
+	struct pnm_index *index = (struct pnm_index *) calloc(1, sizeof(struct pnm_index));
+
+	int correct = fread(magic, 1, 8, stream) == 8 && memcmp(magic, PNM_INDEX_MAGIC, 8) == 0
+	              && fread(&format_version, sizeof(u_int32_t), 1, stream) == 1
+	              && format_version == PNM_INDEX_FORMAT_VERSION
+	              && fread(index, sizeof(struct pnm_index) - sizeof(u_int64_t *), 1, stream) == 1
+	              && index->stride > 0
+	              && index->count == ((u_int64_t) index->height + index->stride - 1) / index->stride;
+	if (correct) {
+		index->offsets = (u_int64_t *) malloc((size_t) index->count * sizeof(u_int64_t) + 1);
+		correct = index->offsets != NULL && fread(index->offsets, sizeof(u_int64_t), index->count, stream) == index->count;
+	}
+	fclose(stream);
+
+	if (!correct) {
+		printf("<index>: \"%s\" is not a correct index.\n", index_path);
+		free_pnm_index(index);
+		return NULL;
+	}
+
+	// compare with the source as it is now
+	struct pnm_index_source *source = _map_index_source(source_path);
+	int fresh = source != NULL && source->size == index->size && source->header.version == index->version
+	            && source->header.width == index->width && source->header.height == index->height
+	            && source->header.scale == index->scale;
+	for (u_int32_t i = 0; fresh && correct && i < index->count; i++) {
+		correct = index->offsets[i] >= source->body && index->offsets[i] < source->size
+		          && (i == 0 || index->offsets[i - 1] <= index->offsets[i]);
+	}
+	if (!correct) {
+		printf("<index>: \"%s\" is not a correct index.\n", index_path);
+		_unmap_index_source(source);
+		free_pnm_index(index);
+		return NULL;
+	}
+
+	int touched = fresh && source->modified != index->modified;
+	if (touched) fresh = _checksum_index_source(source, threads) == index->checksum;
+	if (touched && fresh) index->modified = source->modified;
+	if (source != NULL) _unmap_index_source(source);
+
+	if (!fresh) {
+		printf("<index>: the source has changed since \"%s\" was built.\n", index_path);
+		free_pnm_index(index);
+		return NULL;
+	}
+
+	if (touched) {
+		printf("<index>: the source was touched but not changed => updating \"%s\".\n", index_path);
+		write_pnm_index(index_path, index);
+	}
+
+	return index;
+}
+
+/*
+ * Loads the index of the source, or builds and saves it if there
+ * is no index yet or it does not describe the source anymore.
+ *
+ * Returns NULL if error occurred, otherwise a pointer to the pnm_index structure.
+ */
+struct pnm_index *get_pnm_index(char *source_path, char *index_path, int threads) {
+	struct pnm_index *index = load_pnm_index(source_path, index_path, threads);
+	if (index != NULL) return index;
+
+	printf("<index>: building the index of \"%s\"...\n", source_path);
+	index = build_pnm_index(source_path, PNM_INDEX_STRIDE, threads);
+	if (index == NULL) return NULL;
+
+	write_pnm_index(index_path, index);
+
+	return index;
+}
+
+/*
+ * Frees the index and its offsets
+ */
+void free_pnm_index(struct pnm_index *index) {
+	free(index->offsets);
+	free(index);
+}
+
+/*
+ * Reads the rows [y_from, y_to) of an indexed ASCII image as grayscale, P3
+ * pixels are converted with the given mode. Thanks to the index, parsing
+ * starts right at the nearest indexed row before y_from, and the rows are
+ * divided between the given number of threads, each seeking to its own rows.
+ *
+ * Returns NULL in case of an error or a pointer to an image of y_to - y_from rows.
+ */
+struct grayscale_image *read_indexed_rows(char *source_path, struct pnm_index *index, u_int32_t y_from, u_int32_t y_to,
+                                          int mode, int threads) {
+	if (y_from >= y_to || y_to > index->height) {
+		printf("<index>: incorrect rows requested.\n");
+		return NULL;
+	}
+
+	struct pnm_index_source *source = _map_index_source(source_path);
+	if (source == NULL) return NULL;
+
+	struct pnm_index_parse_task task = {
+		.source = source,
+		.index = index,
+		.result = create_grayscale_image(index->width, y_to - y_from, index->scale),
+		.y_from = y_from,
+		.mode = mode};
+
+	run_row_bands(y_to - y_from, threads, _parse_indexed_rows_thread_job, (void *) &task);
+
+	_unmap_index_source(source);
+
+	if (__atomic_load_n(&task.failed, __ATOMIC_ACQUIRE)) {
+		printf("<index>: ASCII parsing error, incorrect format.\n");
+		free_grayscale_image(task.result);
+		return NULL;
+	}
+
+	return task.result;
+}
+
+/*
+ * A helper function for reading an indexed image. Starts at the indexed row
+ * nearest to the band, skips the rows before the band and parses the band.
+ *
+ * Returns NULL.
+ */
+void *_parse_indexed_rows_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct pnm_index_parse_task *task = (struct pnm_index_parse_task *) band->context;
+	struct pnm_index *index = task->index;
+	u_int32_t width = index->width;
+	u_int32_t channels = index->version == NETPBM_RGB_ASCII ? 3 : 1;
+
+	u_int32_t y = task->y_from + band->from;
+	u_int32_t entry = y / index->stride;
+
+	char *end = task->source->data + task->source->size;
+	char *text = index->offsets[entry] < task->source->size ? task->source->data + index->offsets[entry] : NULL;
+	u_int32_t *samples = (u_int32_t *) malloc(width * channels * sizeof(u_int32_t));
+
+	// skip the rows between the indexed one and the band, a row can only start before the end of the text
+	u_int32_t skipped = entry * index->stride;
+	for (; skipped < y && text != NULL && text < end; skipped++) {
+		text = kernel_parse_ascii(text, end, samples, width * channels);
+	}
+
+	u_int32_t row = band->from;
+	for (; skipped == y && row < band->to && text != NULL && text < end; row++) {
+		if (channels == 1) {
+			text = kernel_parse_ascii(text, end, task->result->matrix[row], width);
+		} else {
+			text = kernel_parse_ascii(text, end, samples, width * channels);
+			if (text != NULL) {
+				kernel_rgb_to_grayscale((struct rgb_color *) samples, task->result->matrix[row], width, index->scale, task->mode);
+			}
+		}
+	}
+
+	if (text == NULL || row < band->to) __atomic_store_n(&task->failed, 1, __ATOMIC_RELEASE);
+
+	free(samples);
+
+	return NULL;
+}
@@ -0,0 +1,99 @@
+#ifndef OMP_INDEX_H
+#define OMP_INDEX_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* DEFINES */
+
+#define PNM_INDEX_MAGIC "PNMINDEX"
+#define PNM_INDEX_FORMAT_VERSION 1
+
+/*
+ * An offset is recorded for every PNM_INDEX_STRIDE-th row
+ */
+#define PNM_INDEX_STRIDE 64
+
+/*
+ * The source is hashed in blocks of this size, so that the checksum does
+ * not depend on the number of threads
+ */
+#define PNM_INDEX_BLOCK_SIZE (1 << 20)
+
+/* STRUCTURES */
+
+/*
+ * A sidecar index of an ASCII (P2 or P3) image: the byte offset of the first
+ * sample of every stride-th row, together with what is needed to tell whether
+ * the source has changed since the index was built.
+ */
+struct pnm_index {
+    int version;
+    u_int32_t width;
+    u_int32_t height;
+    u_int32_t scale;
+    u_int32_t stride;
+    u_int32_t count; // number of offsets, one per stride rows
+    u_int64_t size; // of the source file
+    int64_t modified; // modification time of the source, in nanoseconds
+    u_int64_t checksum;
+    u_int64_t *offsets;
+};
+
+/*
+ * An ASCII image file mapped into memory for building or using an index
+ */
+struct pnm_index_source {
+    struct image_file header;
+    char *data;
+    u_int64_t size;
+    u_int64_t body; // offset of the first sample
+    int64_t modified;
+};
+
+/*
+ * Contains the data shared by the threads building an index. The source is
+ * split into blocks, for every block the threads find the hash and the number
+ * of samples that start in it, then the offsets of the rows.
+ */
+struct pnm_index_build_task {
+    struct pnm_index_source *source;
+    struct pnm_index *index;
+    u_int64_t *hashes;
+    u_int64_t *samples; // samples per block, then the number of samples before the block
+};
+
+/*
+ * Contains the data shared by the threads parsing rows with the help of an index.
+ */
+struct pnm_index_parse_task {
+    struct pnm_index_source *source;
+    struct pnm_index *index;
+    struct grayscale_image *result;
+    u_int32_t y_from;
+    int mode;
+    int failed; // set by any thread, accessed atomically
+};
+
+/* FUNCTIONS */
+
+/* Building, saving and loading */
+struct pnm_index *build_pnm_index(char *source_path, u_int32_t stride, int threads);
+int write_pnm_index(char *index_path, struct pnm_index *index);
+struct pnm_index *load_pnm_index(char *source_path, char *index_path, int threads);
+struct pnm_index *get_pnm_index(char *source_path, char *index_path, int threads);
+void free_pnm_index(struct pnm_index *index);
+
+/* Reading the image */
+struct grayscale_image *read_indexed_rows(char *source_path, struct pnm_index *index, u_int32_t y_from, u_int32_t y_to,
+                                          int mode, int threads);
+
+/* Helpers */
+static struct pnm_index_source *_map_index_source(char *source_path);
+static void _unmap_index_source(struct pnm_index_source *source);
+static u_int64_t _checksum_index_source(struct pnm_index_source *source, int threads);
+void *_hash_blocks_thread_job(void *data);
+void *_count_samples_thread_job(void *data);
+void *_find_rows_thread_job(void *data);
+void *_parse_indexed_rows_thread_job(void *data);
+
+#endif // OMP_INDEX_H
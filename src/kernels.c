@@ -0,0 +1,226 @@
+#include "kernels.h"
+
+#include <math.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#define _KERNEL_CONCAT(name, tier) _KERNEL_CONCAT_EXPANDED(name, tier)
+#define _KERNEL_CONCAT_EXPANDED(name, tier) name##_##tier
+
+/*
+ * Converts a single pixel to grayscale using the given mode,
+ * exactly as the vectorized part of the kernel does.
+ *
+ * Returns the grayscale value.
+ */
+static inline u_int32_t _rgb_to_gray(u_int32_t r, u_int32_t g, u_int32_t b, int mode) {
+	switch (mode) {
+		case GRAYSCALE_BT601:
+			return (r * BT601_WEIGHT_R + g * BT601_WEIGHT_G + b * BT601_WEIGHT_B + (1 << 15)) >> 16;
+		case GRAYSCALE_BT709:
+			return (r * BT709_WEIGHT_R + g * BT709_WEIGHT_G + b * BT709_WEIGHT_B + (1 << 15)) >> 16;
+		default:
+			return (r + g + b) / 3;
+	}
+}
+
+/*
+ * Prepares one channel of a row for the color sobel: the vertically smoothed
+ * (above + 2 * row + below) and the vertically differentiated (below - above)
+ * values, stored with one zero on each side so that the borders of the image
+ * behave as in calculate_sobel_at.
+ */
+static inline void _sobel_rgb_prepare_pixel(struct rgb_color *above, struct rgb_color *row, struct rgb_color *below,
+                                            u_int32_t x, int32_t **smooth, int32_t **diff) {
+	u_int32_t zero[3] = {0, 0, 0};
+	u_int32_t *a = above != NULL ? (u_int32_t *) &above[x] : zero;
+	u_int32_t *r = (u_int32_t *) &row[x];
+	u_int32_t *b = below != NULL ? (u_int32_t *) &below[x] : zero;
+
+	for (int c = 0; c < 3; c++) {
+		smooth[c][x + 1] = (int32_t) (a[c] + 2 * r[c] + b[c]);
+		diff[c][x + 1] = (int32_t) b[c] - (int32_t) a[c];
+	}
+}
+
+/*
+ * Parses count unsigned decimal numbers separated by whitespace from the text,
+ * stopping at end. Much lighter than fscanf, which matters for big ASCII images.
+ *
+ * Returns NULL if the text is incorrect or too short, otherwise returns
+ * a pointer to the character after the last number.
+ */
+static char *_parse_ascii(char *text, char *end, u_int32_t *values, u_int32_t count) {
+	for (u_int32_t i = 0; i < count; i++) {
+		while (text < end && (*text == ' ' || *text == '\n' || *text == '\r' || *text == '\t')) text++;
+		if (text == end || *text < '0' || *text > '9') return NULL;
+
+		u_int32_t value = 0;
+		while (text < end && *text >= '0' && *text <= '9') value = value * 10 + (*text++ - '0');
+		values[i] = value;
+	}
+
+	return text;
+}
+
+/*
+ * Counts the set bits of the mask starting from the given one, up to the
+ * width of the mask in bits.
+ */
+static inline u_int32_t _count_ones_from(u_int64_t mask, u_int32_t from, u_int32_t width) {
+	u_int64_t zeros = ~mask >> from;
+	if (zeros == 0) return width - from;
+
+	u_int32_t count = __builtin_ctzll(zeros);
+	return count < width - from ? count : width - from;
+}
+
+/*
+ * The kernels that are used, bound to one of the tiers by select_kernel_tier
+ */
+void (*kernel_rgb_to_grayscale)(struct rgb_color *row, u_int32_t *result, u_int32_t width, u_int32_t scale, int mode);
+void (*kernel_sobel_rgb_row)(struct rgb_color *above, struct rgb_color *row, struct rgb_color *below,
+                             u_int32_t *result, u_int32_t width, u_int32_t scale, int mode, int32_t *scratch);
+void (*kernel_sobel_grayscale_row)(u_int32_t *above, u_int32_t *row, u_int32_t *below, u_int32_t *result,
+                                   u_int32_t x_from, u_int32_t x_to, u_int32_t width, u_int32_t scale, int32_t *scratch);
+void (*kernel_threshold_row)(u_int32_t *row, u_int8_t *result, u_int32_t width, u_int32_t threshold);
+void (*kernel_pack_samples)(u_int32_t *samples, u_int8_t *bytes, u_int32_t count);
+void (*kernel_unpack_samples)(u_int8_t *bytes, u_int32_t *samples, u_int32_t count);
+int (*kernel_rows_differ)(u_int32_t *a, u_int32_t *b, u_int32_t count);
+char *(*kernel_parse_ascii)(char *text, char *end, u_int32_t *values, u_int32_t count);
+void (*kernel_reduce_box_row)(u_int32_t *row0, u_int32_t *row1, u_int32_t *result, u_int32_t width);
+void (*kernel_reduce_gaussian_row)(u_int32_t **rows, u_int32_t *result, u_int32_t width, u_int32_t *scratch);
+void (*kernel_median_row)(u_int32_t **rows, u_int32_t *result, u_int32_t width, u_int32_t radius, u_int32_t *scratch);
+
+/*
+ * Plain C, one lane at a time
+ */
+#define KERNEL_TIER scalar
+#define KERNEL_LANES 1
+#define KERNEL_TARGET __attribute__((optimize("no-tree-vectorize")))
+#include "kernels_tier.h"
+#undef KERNEL_TIER
+#undef KERNEL_LANES
+#undef KERNEL_TARGET
+
+#ifdef __x86_64__
+
+/*
+ * 128-bit vectors, every x86-64 processor has them
+ */
+#define KERNEL_TIER sse2
+#define KERNEL_LANES 4
+#define KERNEL_TARGET
+#include "kernels_tier.h"
+#undef KERNEL_TIER
+#undef KERNEL_LANES
+#undef KERNEL_TARGET
+
+/*
+ * 256-bit vectors. FMA is left out on purpose, fused operations would
+ * round the color sobel differently from the other tiers.
+ */
+#define KERNEL_TIER avx2
+#define KERNEL_LANES 8
+#define KERNEL_TARGET __attribute__((target("avx2")))
+#include "kernels_tier.h"
+#undef KERNEL_TIER
+#undef KERNEL_LANES
+#undef KERNEL_TARGET
+
+/*
+ * 512-bit vectors, byte operations need the BW extension
+ */
+#define KERNEL_TIER avx512
+#define KERNEL_LANES 16
+#define KERNEL_TARGET __attribute__((target("avx512f,avx512bw")))
+#include "kernels_tier.h"
+#undef KERNEL_TIER
+#undef KERNEL_LANES
+#undef KERNEL_TARGET
+
+#else
+
+/*
+ * 128-bit vectors of whatever SIMD instructions the target has
+ */
+#define KERNEL_TIER generic
+#define KERNEL_LANES 4
+#define KERNEL_TARGET
+#include "kernels_tier.h"
+#undef KERNEL_TIER
+#undef KERNEL_LANES
+#undef KERNEL_TARGET
+
+#endif
+
+/*
+ * The tiers from the slowest to the fastest
+ */
+static const struct kernel_tier kernel_tiers[] = {
+	{"scalar", _bind_kernels_scalar},
+#ifdef __x86_64__
+	{"sse2", _bind_kernels_sse2},
+	{"avx2", _bind_kernels_avx2},
+	{"avx512", _bind_kernels_avx512},
+#else
+	{"generic", _bind_kernels_generic},
+#endif
+};
+
+#define KERNEL_TIER_COUNT (sizeof(kernel_tiers) / sizeof(struct kernel_tier))
+
+/*
+ * Checks whether the processor (and the operating system) supports the tier.
+ *
+ * Returns 1 if it does, otherwise returns 0.
+ */
+static int _kernel_tier_supported(const char *name) {
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+	if (strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+	return 1;
+}
+
+/*
+ * Binds the kernels to the fastest tier the processor supports, or to the
+ * tier named by the KERNEL_TIER_ENV environment variable if it is supported.
+ * All the tiers give the same results, so this only changes the speed.
+ *
+ * Returns the name of the tier.
+ */
+const char *select_kernel_tier() {
+	char *forced = getenv(KERNEL_TIER_ENV);
+
+	for (int i = KERNEL_TIER_COUNT - 1; forced != NULL && i >= 0; i--) {
+		if (strcmp(forced, kernel_tiers[i].name) != 0) continue;
+
+		if (_kernel_tier_supported(kernel_tiers[i].name)) {
+			kernel_tiers[i].bind();
+			return kernel_tiers[i].name;
+		}
+		printf("<kernels>: the processor does not support the %s kernels.\n", forced);
+		forced = NULL;
+	}
+	if (forced != NULL) printf("<kernels>: unknown kernel tier \"%s\".\n", forced);
+
+	for (int i = KERNEL_TIER_COUNT - 1; i > 0; i--) {
+		if (!_kernel_tier_supported(kernel_tiers[i].name)) continue;
+		kernel_tiers[i].bind();
+		return kernel_tiers[i].name;
+	}
+
+	kernel_tiers[0].bind();
+	return kernel_tiers[0].name;
+}
+
+/*
+ * Makes sure the kernels are bound before main runs, so that they can
+ * be used even if select_kernel_tier is never called.
+ */
+__attribute__((constructor)) static void _bind_default_kernels() {
+	kernel_tiers[KERNEL_TIER_COUNT > 1 ? 1 : 0].bind();
+}
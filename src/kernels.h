@@ -0,0 +1,117 @@
+#ifndef OMP_KERNELS_H
+#define OMP_KERNELS_H
+
+#include "netpbm.h" // we are going to need image structures
+#include "sobel.h"
+
+/* DEFINES */
+
+/*
+ * Fixed-point weights of the color channels for the grayscale conversion,
+ * each set sums up to 1 << 16.
+ */
+#define BT601_WEIGHT_R 19595
+#define BT601_WEIGHT_G 38470
+#define BT601_WEIGHT_B 7471
+
+#define BT709_WEIGHT_R 13933
+#define BT709_WEIGHT_G 46871
+#define BT709_WEIGHT_B 4732
+
+/*
+ * Division by 3 is done as (sum * 43691) >> 17, which is exact and does
+ * not overflow while the sum of the channels stays below 98304.
+ */
+#define AVERAGE_RECIPROCAL 43691
+#define AVERAGE_SHIFT 17
+#define AVERAGE_MAX_SCALE 32767
+
+/*
+ * Number of 32-bit lanes in the widest vector a kernel may use,
+ * scratch buffers leave this much room after the end of a row.
+ */
+#define KERNEL_MAX_LANES 16
+
+/*
+ * Number of integers needed by kernel_sobel_rgb_row for a row of the given width:
+ * smoothed and differentiated values of 3 channels, padded on both sides
+ * and with room for one more vector at the end.
+ */
+#define SOBEL_RGB_SCRATCH(width) (6 * ((width) + 2 + KERNEL_MAX_LANES))
+
+/*
+ * Number of integers needed by kernel_sobel_grayscale_row for the given number
+ * of columns: smoothed and differentiated values with the same padding.
+ */
+#define SOBEL_GRAYSCALE_SCRATCH(count) (2 * ((count) + 2 + KERNEL_MAX_LANES))
+
+/*
+ * Number of integers needed by kernel_reduce_gaussian_row for a row of the given
+ * width: the vertically filtered row, two repeated columns on each side and
+ * room for reading two more vectors at the end.
+ */
+#define REDUCE_SCRATCH(width) ((width) + 4 + 2 * KERNEL_MAX_LANES)
+
+/*
+ * The median filter goes up to 5x5, which leaves 13 candidates for the median
+ * after sorting, and needs every rank of every column of the row with the
+ * columns repeated at both ends and room for one more vector
+ */
+#define MEDIAN_MAX_RADIUS 2
+#define MEDIAN_MAX_CANDIDATES 13
+#define MEDIAN_SCRATCH(width, radius) ((2 * (radius) + 1) * ((width) + 2 * (radius) + KERNEL_MAX_LANES))
+
+/*
+ * The environment variable that forces a tier of the kernels:
+ * scalar, sse2, avx2 or avx512 (generic on other processors)
+ */
+#define KERNEL_TIER_ENV "SOBEL_KERNEL_TIER"
+
+/* STRUCTURES */
+
+/*
+ * A tier of the kernels, compiled for one instruction set.
+ * bind points all the kernel pointers at the kernels of the tier.
+ */
+struct kernel_tier {
+    const char *name;
+    void (*bind)(void);
+};
+
+/* FUNCTIONS */
+
+/* Dispatch */
+const char *select_kernel_tier();
+
+/*
+ * The kernels are pointers bound to the tier that fits the processor
+ */
+
+/* Grayscale conversion */
+extern void (*kernel_rgb_to_grayscale)(struct rgb_color *row, u_int32_t *result, u_int32_t width, u_int32_t scale, int mode);
+
+/* Sobel operation */
+extern void (*kernel_sobel_rgb_row)(struct rgb_color *above, struct rgb_color *row, struct rgb_color *below,
+                                    u_int32_t *result, u_int32_t width, u_int32_t scale, int mode, int32_t *scratch);
+extern void (*kernel_sobel_grayscale_row)(u_int32_t *above, u_int32_t *row, u_int32_t *below, u_int32_t *result,
+                                          u_int32_t x_from, u_int32_t x_to, u_int32_t width, u_int32_t scale, int32_t *scratch);
+
+/* Downsampling */
+extern void (*kernel_reduce_box_row)(u_int32_t *row0, u_int32_t *row1, u_int32_t *result, u_int32_t width);
+extern void (*kernel_reduce_gaussian_row)(u_int32_t **rows, u_int32_t *result, u_int32_t width, u_int32_t *scratch);
+
+/* Denoising */
+extern void (*kernel_median_row)(u_int32_t **rows, u_int32_t *result, u_int32_t width, u_int32_t radius, u_int32_t *scratch);
+
+/* Parsing and packing */
+extern char *(*kernel_parse_ascii)(char *text, char *end, u_int32_t *values, u_int32_t count);
+extern void (*kernel_pack_samples)(u_int32_t *samples, u_int8_t *bytes, u_int32_t count);
+extern void (*kernel_unpack_samples)(u_int8_t *bytes, u_int32_t *samples, u_int32_t count);
+
+/* Binarization */
+extern void (*kernel_threshold_row)(u_int32_t *row, u_int8_t *result, u_int32_t width, u_int32_t threshold);
+
+/* Comparison */
+extern int (*kernel_rows_differ)(u_int32_t *a, u_int32_t *b, u_int32_t count);
+
+#endif // OMP_KERNELS_H
@@ -0,0 +1,676 @@
+/*
+ * The kernels of one instruction set tier. This file has no include guard on
+ * purpose: kernels.c includes it once per tier, after defining
+ *
+ *   KERNEL_TIER    - the suffix of the names of this tier, e.g. avx2
+ *   KERNEL_LANES   - the number of 32-bit lanes in a vector: 1, 4, 8 or 16
+ *   KERNEL_TARGET  - the attributes every function of the tier is compiled with
+ *
+ * All the tiers run the same operations in the same order, only on vectors of
+ * a different width, so they give bit-identical results.
+ */
+
+#define KERNEL_NAME(name) _KERNEL_CONCAT(name, KERNEL_TIER)
+
+/*
+ * Vectors of 32-bit lanes, the compiler maps the operations on them
+ * to the SIMD instructions of the tier.
+ */
+typedef u_int32_t KERNEL_NAME(vec_u32) __attribute__((vector_size(4 * KERNEL_LANES)));
+typedef int32_t KERNEL_NAME(vec_i32) __attribute__((vector_size(4 * KERNEL_LANES)));
+typedef float KERNEL_NAME(vec_f32) __attribute__((vector_size(4 * KERNEL_LANES)));
+typedef u_int8_t KERNEL_NAME(vec_u8) __attribute__((vector_size(KERNEL_LANES))); // one byte per 32-bit lane
+typedef u_int8_t KERNEL_NAME(vec_bytes) __attribute__((vector_size(4 * KERNEL_LANES))); // as many bytes as fit
+
+#define vec_u32 KERNEL_NAME(vec_u32)
+#define vec_i32 KERNEL_NAME(vec_i32)
+#define vec_f32 KERNEL_NAME(vec_f32)
+#define vec_u8 KERNEL_NAME(vec_u8)
+#define vec_bytes KERNEL_NAME(vec_bytes)
+
+#define VEC_LANES KERNEL_LANES
+
+/*
+ * Shuffle masks are spelled out lane by lane with f(lane, argument)
+ */
+#if KERNEL_LANES == 1
+#define VEC_MASK(f, arg) ((vec_u32) {f(0, arg)})
+#elif KERNEL_LANES == 4
+#define VEC_MASK(f, arg) ((vec_u32) {f(0, arg), f(1, arg), f(2, arg), f(3, arg)})
+#elif KERNEL_LANES == 8
+#define VEC_MASK(f, arg) ((vec_u32) {f(0, arg), f(1, arg), f(2, arg), f(3, arg), \
+                                     f(4, arg), f(5, arg), f(6, arg), f(7, arg)})
+#else
+#define VEC_MASK(f, arg) ((vec_u32) {f(0, arg), f(1, arg), f(2, arg), f(3, arg), \
+                                     f(4, arg), f(5, arg), f(6, arg), f(7, arg), \
+                                     f(8, arg), f(9, arg), f(10, arg), f(11, arg), \
+                                     f(12, arg), f(13, arg), f(14, arg), f(15, arg)})
+#endif
+
+/*
+ * Splits VEC_LANES interleaved R, G, B triples into separate channel vectors.
+ * Sample 3 * i + c of the three vectors goes to lane i of channel c: the ones
+ * within the first two vectors are picked first, then the rest from the third.
+ */
+#define _DEINTERLEAVE_FIRST(i, c) (3 * (i) + (c) < 2 * VEC_LANES ? 3 * (i) + (c) : 0)
+#define _DEINTERLEAVE_SECOND(i, c) (3 * (i) + (c) < 2 * VEC_LANES ? (i) : 3 * (i) + (c) - VEC_LANES)
+
+static inline KERNEL_TARGET void KERNEL_NAME(_deinterleave_rgb)(u_int32_t *samples, vec_u32 *r, vec_u32 *g, vec_u32 *b) {
+	vec_u32 v0, v1, v2;
+	memcpy(&v0, samples, sizeof(vec_u32));
+	memcpy(&v1, samples + VEC_LANES, sizeof(vec_u32));
+	memcpy(&v2, samples + 2 * VEC_LANES, sizeof(vec_u32));
+
+	*r = __builtin_shuffle(__builtin_shuffle(v0, v1, VEC_MASK(_DEINTERLEAVE_FIRST, 0)), v2, VEC_MASK(_DEINTERLEAVE_SECOND, 0));
+	*g = __builtin_shuffle(__builtin_shuffle(v0, v1, VEC_MASK(_DEINTERLEAVE_FIRST, 1)), v2, VEC_MASK(_DEINTERLEAVE_SECOND, 1));
+	*b = __builtin_shuffle(__builtin_shuffle(v0, v1, VEC_MASK(_DEINTERLEAVE_FIRST, 2)), v2, VEC_MASK(_DEINTERLEAVE_SECOND, 2));
+}
+
+static inline KERNEL_TARGET vec_u32 KERNEL_NAME(_min_u32)(vec_u32 a, vec_u32 b) {
+	vec_u32 mask = (vec_u32) (a < b);
+	return (a & mask) | (b & ~mask);
+}
+
+static inline KERNEL_TARGET vec_u32 KERNEL_NAME(_max_u32)(vec_u32 a, vec_u32 b) {
+	vec_u32 mask = (vec_u32) (a > b);
+	return (a & mask) | (b & ~mask);
+}
+
+static inline KERNEL_TARGET vec_u32 KERNEL_NAME(_abs_i32)(vec_i32 a) {
+	vec_i32 sign = a >> 31;
+	return (vec_u32) ((a ^ sign) - sign);
+}
+
+static inline KERNEL_TARGET vec_f32 KERNEL_NAME(_sqrt_f32)(vec_f32 a) {
+#if KERNEL_LANES == 16
+	return (vec_f32) _mm512_sqrt_ps((__m512) a);
+#elif KERNEL_LANES == 8
+	return (vec_f32) _mm256_sqrt_ps((__m256) a);
+#elif KERNEL_LANES == 4 && defined(__SSE__)
+	return (vec_f32) _mm_sqrt_ps((__m128) a);
+#else
+	for (int i = 0; i < VEC_LANES; i++) a[i] = sqrtf(a[i]);
+	return a;
+#endif
+}
+
+/*
+ * Finds min(floor(sqrt(s)), scale) for every lane. The root is taken in
+ * single precision and then corrected by one in either direction, which
+ * makes the result exact for any 32-bit input.
+ */
+static inline KERNEL_TARGET vec_u32 KERNEL_NAME(_isqrt_clamped)(vec_u32 s, u_int32_t scale) {
+	vec_u32 root = __builtin_convertvector(KERNEL_NAME(_sqrt_f32)(__builtin_convertvector(s, vec_f32)), vec_u32);
+	root = KERNEL_NAME(_min_u32)(root, (vec_u32) {} + scale);
+
+	// masks are -1 where true, so adding one decrements and subtracting one increments
+	root += (vec_u32) (root * root > s);
+	vec_u32 next = root + 1;
+	root -= (vec_u32) (next <= scale) & (vec_u32) (next * next <= s);
+
+	return root;
+}
+
+/*
+ * Converts a row of RGB pixels to grayscale. Pixels are taken a vector at a time,
+ * the interleaved R, G, B triples are split into separate channel vectors
+ * with shuffles and then mixed with fixed-point weights. The average is
+ * computed with a multiplication by the reciprocal of 3 instead of a division.
+ * The pixels that do not fill a whole vector are converted one by one.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_rgb_to_grayscale)(struct rgb_color *row, u_int32_t *result,
+                                                             u_int32_t width, u_int32_t scale, int mode) {
+	u_int32_t *samples = (u_int32_t *) row;
+	u_int32_t x = 0;
+
+	// the reciprocal trick overflows for very deep images, leave those to the scalar loop
+	u_int32_t vector_end = width - width % VEC_LANES;
+	if (mode == GRAYSCALE_AVERAGE && scale > AVERAGE_MAX_SCALE) vector_end = 0;
+
+	u_int32_t weight_r = mode == GRAYSCALE_BT601 ? BT601_WEIGHT_R : BT709_WEIGHT_R;
+	u_int32_t weight_g = mode == GRAYSCALE_BT601 ? BT601_WEIGHT_G : BT709_WEIGHT_G;
+	u_int32_t weight_b = mode == GRAYSCALE_BT601 ? BT601_WEIGHT_B : BT709_WEIGHT_B;
+
+	for (; x < vector_end; x += VEC_LANES) {
+		vec_u32 r, g, b;
+		KERNEL_NAME(_deinterleave_rgb)(samples + 3 * x, &r, &g, &b);
+
+		vec_u32 gray;
+		if (mode == GRAYSCALE_AVERAGE) gray = ((r + g + b) * AVERAGE_RECIPROCAL) >> AVERAGE_SHIFT;
+		else gray = (r * weight_r + g * weight_g + b * weight_b + (1 << 15)) >> 16;
+
+		memcpy(result + x, &gray, sizeof(vec_u32));
+	}
+
+	for (; x < width; x++) {
+		result[x] = _rgb_to_gray(row[x].r, row[x].g, row[x].b, mode);
+	}
+}
+
+/*
+ * Applies the sobel operator to all three channels of an RGB row at once and
+ * combines the gradients into one magnitude: the largest of the channel
+ * magnitudes (SOBEL_COLOR_MAX) or the square root of the largest eigenvalue
+ * of the Di Zenzo structure tensor, divided by the number of channels so that
+ * a gray image gives the same edges (SOBEL_COLOR_DIZENZO). Rows above and below
+ * are NULL at the borders of the image.
+ *
+ * The scratch buffer must hold SOBEL_RGB_SCRATCH(width) integers.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_sobel_rgb_row)(struct rgb_color *above, struct rgb_color *row,
+                                                          struct rgb_color *below, u_int32_t *result, u_int32_t width,
+                                                          u_int32_t scale, int mode, int32_t *scratch) {
+	u_int32_t stride = width + 2 + KERNEL_MAX_LANES;
+	int32_t *smooth[3], *diff[3];
+	for (int c = 0; c < 3; c++) {
+		smooth[c] = scratch + 2 * c * stride;
+		diff[c] = scratch + (2 * c + 1) * stride;
+		smooth[c][0] = smooth[c][width + 1] = 0;
+		diff[c][0] = diff[c][width + 1] = 0;
+	}
+
+	// first step: vertical part of the kernels, channels split apart
+	u_int32_t x = 0;
+	for (; x + VEC_LANES <= width; x += VEC_LANES) {
+		vec_u32 a[3] = {}, r[3], b[3] = {};
+		if (above != NULL) KERNEL_NAME(_deinterleave_rgb)((u_int32_t *) &above[x], &a[0], &a[1], &a[2]);
+		KERNEL_NAME(_deinterleave_rgb)((u_int32_t *) &row[x], &r[0], &r[1], &r[2]);
+		if (below != NULL) KERNEL_NAME(_deinterleave_rgb)((u_int32_t *) &below[x], &b[0], &b[1], &b[2]);
+
+		for (int c = 0; c < 3; c++) {
+			vec_i32 s = (vec_i32) (a[c] + 2 * r[c] + b[c]);
+			vec_i32 d = (vec_i32) b[c] - (vec_i32) a[c];
+			memcpy(&smooth[c][x + 1], &s, sizeof(vec_i32));
+			memcpy(&diff[c][x + 1], &d, sizeof(vec_i32));
+		}
+	}
+	for (; x < width; x++) _sobel_rgb_prepare_pixel(above, row, below, x, smooth, diff);
+
+	// second step: horizontal part and the magnitude, the last vector may stick
+	// out of the row, those lanes are computed on padding and thrown away
+	vec_u32 scale_squared = (vec_u32) {} + scale * scale;
+	for (x = 0; x < width; x += VEC_LANES) {
+		vec_i32 gx[3], gy[3];
+		for (int c = 0; c < 3; c++) {
+			vec_i32 s0, s2, d0, d1, d2;
+			memcpy(&s0, &smooth[c][x], sizeof(vec_i32));
+			memcpy(&s2, &smooth[c][x + 2], sizeof(vec_i32));
+			memcpy(&d0, &diff[c][x], sizeof(vec_i32));
+			memcpy(&d1, &diff[c][x + 1], sizeof(vec_i32));
+			memcpy(&d2, &diff[c][x + 2], sizeof(vec_i32));
+
+			gx[c] = s2 - s0;
+			gy[c] = d0 + 2 * d1 + d2;
+		}
+
+		vec_u32 magnitude;
+		if (mode == SOBEL_COLOR_DIZENZO) {
+			vec_f32 gxx = {}, gyy = {}, gxy = {};
+			for (int c = 0; c < 3; c++) {
+				vec_f32 fx = __builtin_convertvector(gx[c], vec_f32);
+				vec_f32 fy = __builtin_convertvector(gy[c], vec_f32);
+				gxx += fx * fx;
+				gyy += fy * fy;
+				gxy += fx * fy;
+			}
+
+			vec_f32 delta = gxx - gyy;
+			vec_f32 lambda = (gxx + gyy + KERNEL_NAME(_sqrt_f32)(delta * delta + 4 * gxy * gxy)) * 0.5f;
+			vec_f32 root = KERNEL_NAME(_sqrt_f32)(lambda * (1.0f / 3));
+
+			// clamp before converting so that the values fit into the lanes
+			vec_i32 over = root > (float) scale;
+			magnitude = (vec_u32) ((over & (int32_t) scale) | (~over & __builtin_convertvector(root, vec_i32)));
+		} else {
+			// squares are saturated at scale^2 so that deep images do not overflow
+			vec_u32 squared = {};
+			for (int c = 0; c < 3; c++) {
+				vec_u32 ax = KERNEL_NAME(_min_u32)(KERNEL_NAME(_abs_i32)(gx[c]), (vec_u32) {} + scale);
+				vec_u32 ay = KERNEL_NAME(_min_u32)(KERNEL_NAME(_abs_i32)(gy[c]), (vec_u32) {} + scale);
+				vec_u32 xx = ax * ax;
+				squared = KERNEL_NAME(_max_u32)(squared, xx + KERNEL_NAME(_min_u32)(ay * ay, scale_squared - xx));
+			}
+			magnitude = KERNEL_NAME(_isqrt_clamped)(squared, scale);
+		}
+
+		u_int32_t lanes = width - x < VEC_LANES ? width - x : VEC_LANES;
+		memcpy(result + x, &magnitude, lanes * sizeof(u_int32_t));
+	}
+}
+
+/*
+ * Applies the sobel operator to the columns [x_from, x_to) of a grayscale row,
+ * giving exactly the same values as calculate_sobel_at, including the
+ * wrap-around of the unsigned arithmetic. The vertical part of the kernels is
+ * computed first, then the horizontal part and the magnitude take a vector of
+ * pixels at a time. Rows above and below are NULL at the borders of the image.
+ *
+ * The scratch buffer must hold SOBEL_GRAYSCALE_SCRATCH(x_to - x_from) integers.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_sobel_grayscale_row)(u_int32_t *above, u_int32_t *row, u_int32_t *below,
+                                                                u_int32_t *result, u_int32_t x_from, u_int32_t x_to,
+                                                                u_int32_t width, u_int32_t scale, int32_t *scratch) {
+	if (x_from >= x_to) return;
+
+	// smooth[i] and diff[i] belong to the column x_from - 1 + i
+	u_int32_t count = x_to - x_from;
+	int32_t *smooth = scratch;
+	int32_t *diff = scratch + count + 2 + KERNEL_MAX_LANES;
+
+	// columns outside of the image stay zero
+	smooth[0] = diff[0] = 0;
+	smooth[count + 1] = diff[count + 1] = 0;
+	u_int32_t from = x_from > 0 ? x_from - 1 : x_from;
+	u_int32_t to = x_to < width ? x_to + 1 : x_to;
+
+	// first step: vertical part of the kernels
+	u_int32_t x = from;
+	for (; x + VEC_LANES <= to; x += VEC_LANES) {
+		vec_i32 a = {}, r, b = {};
+		if (above != NULL) memcpy(&a, above + x, sizeof(vec_i32));
+		memcpy(&r, row + x, sizeof(vec_i32));
+		if (below != NULL) memcpy(&b, below + x, sizeof(vec_i32));
+
+		vec_i32 s = a + 2 * r + b;
+		vec_i32 d = b - a;
+		memcpy(&smooth[x - x_from + 1], &s, sizeof(vec_i32));
+		memcpy(&diff[x - x_from + 1], &d, sizeof(vec_i32));
+	}
+	for (; x < to; x++) {
+		int32_t a = above != NULL ? (int32_t) above[x] : 0;
+		int32_t b = below != NULL ? (int32_t) below[x] : 0;
+		smooth[x - x_from + 1] = a + 2 * (int32_t) row[x] + b;
+		diff[x - x_from + 1] = b - a;
+	}
+
+	// second step: horizontal part and the magnitude, the last vector may stick
+	// out of the range, those lanes are computed on padding and thrown away
+	for (x = 0; x < count; x += VEC_LANES) {
+		vec_i32 s0, s2, d0, d1, d2;
+		memcpy(&s0, &smooth[x], sizeof(vec_i32));
+		memcpy(&s2, &smooth[x + 2], sizeof(vec_i32));
+		memcpy(&d0, &diff[x], sizeof(vec_i32));
+		memcpy(&d1, &diff[x + 1], sizeof(vec_i32));
+		memcpy(&d2, &diff[x + 2], sizeof(vec_i32));
+
+		vec_u32 gx = (vec_u32) (s2 - s0);
+		vec_u32 gy = (vec_u32) (d0 + 2 * d1 + d2);
+		vec_u32 magnitude = KERNEL_NAME(_isqrt_clamped)(gx * gx + gy * gy, scale);
+
+		u_int32_t lanes = count - x < VEC_LANES ? count - x : VEC_LANES;
+		memcpy(result + x_from + x, &magnitude, lanes * sizeof(u_int32_t));
+	}
+}
+
+/*
+ * Binarizes a row: a sample above the threshold becomes 1, any other becomes 0.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_threshold_row)(u_int32_t *row, u_int8_t *result, u_int32_t width,
+                                                          u_int32_t threshold) {
+	u_int32_t x = 0;
+	for (; x + VEC_LANES <= width; x += VEC_LANES) {
+		vec_u32 v;
+		memcpy(&v, row + x, sizeof(vec_u32));
+		vec_u8 bits = __builtin_convertvector(-(v > threshold), vec_u8);
+		memcpy(result + x, &bits, sizeof(vec_u8));
+	}
+	for (; x < width; x++) result[x] = row[x] > threshold;
+}
+
+/*
+ * Narrows samples to bytes for the binary formats, keeping the low byte as a
+ * cast would.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_pack_samples)(u_int32_t *samples, u_int8_t *bytes, u_int32_t count) {
+	u_int32_t x = 0;
+	for (; x + VEC_LANES <= count; x += VEC_LANES) {
+		vec_u32 v;
+		memcpy(&v, samples + x, sizeof(vec_u32));
+		vec_u8 packed = __builtin_convertvector(v, vec_u8);
+		memcpy(bytes + x, &packed, sizeof(vec_u8));
+	}
+	for (; x < count; x++) bytes[x] = (u_int8_t) samples[x];
+}
+
+/*
+ * Widens bytes of the binary formats to samples.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_unpack_samples)(u_int8_t *bytes, u_int32_t *samples, u_int32_t count) {
+	u_int32_t x = 0;
+	for (; x + VEC_LANES <= count; x += VEC_LANES) {
+		vec_u8 packed;
+		memcpy(&packed, bytes + x, sizeof(vec_u8));
+		vec_u32 v = __builtin_convertvector(packed, vec_u32);
+		memcpy(samples + x, &v, sizeof(vec_u32));
+	}
+	for (; x < count; x++) samples[x] = bytes[x];
+}
+
+/*
+ * Compares two rows of samples a vector at a time.
+ *
+ * Returns 1 if the rows differ, otherwise returns 0.
+ */
+static KERNEL_TARGET int KERNEL_NAME(kernel_rows_differ)(u_int32_t *a, u_int32_t *b, u_int32_t count) {
+	vec_u32 difference = {};
+
+	u_int32_t x = 0;
+	for (; x + VEC_LANES <= count; x += VEC_LANES) {
+		vec_u32 va, vb;
+		memcpy(&va, a + x, sizeof(vec_u32));
+		memcpy(&vb, b + x, sizeof(vec_u32));
+		difference |= va ^ vb;
+	}
+	for (; x < count; x++) difference[0] |= a[x] ^ b[x];
+
+	for (int i = 0; i < VEC_LANES; i++) {
+		if (difference[i] != 0) return 1;
+	}
+
+	return 0;
+}
+
+#if KERNEL_LANES > 1 && defined(__x86_64__)
+/*
+ * One bit for every byte of the vector, set where the byte is not zero
+ */
+static inline KERNEL_TARGET u_int64_t KERNEL_NAME(_byte_mask)(vec_bytes v) {
+#if KERNEL_LANES == 16
+	return (u_int64_t) _mm512_movepi8_mask((__m512i) v);
+#elif KERNEL_LANES == 8
+	return (u_int32_t) _mm256_movemask_epi8((__m256i) v);
+#else
+	return (u_int32_t) _mm_movemask_epi8((__m128i) v);
+#endif
+}
+
+/*
+ * Parses count unsigned decimal numbers separated by whitespace from the text,
+ * stopping at end, exactly as _parse_ascii. A vector of characters is loaded at
+ * a time and turned into bit masks of the whitespace and of the digits, so the
+ * numbers and the gaps between them are found by counting bits. A number that
+ * reaches the end of the vector is parsed from the next load.
+ *
+ * Returns NULL if the text is incorrect or too short, otherwise returns
+ * a pointer to the character after the last number.
+ */
+static KERNEL_TARGET char *KERNEL_NAME(kernel_parse_ascii)(char *text, char *end, u_int32_t *values, u_int32_t count) {
+	u_int32_t i = 0;
+	while (i < count && end - text >= (int64_t) sizeof(vec_bytes)) {
+		vec_bytes chunk;
+		memcpy(&chunk, text, sizeof(vec_bytes));
+		u_int64_t space = KERNEL_NAME(_byte_mask)((chunk == ' ') | (chunk == '\n') | (chunk == '\r') | (chunk == '\t'));
+		u_int64_t digit = KERNEL_NAME(_byte_mask)((vec_bytes) (chunk - '0') < 10);
+
+		// p is where the next number may start, numbers reaching the end are left for the next load
+		u_int32_t p = 0;
+		while (i < count) {
+			p += _count_ones_from(space, p, sizeof(vec_bytes));
+			if (p == sizeof(vec_bytes)) break;
+			if (((digit >> p) & 1) == 0) return NULL;
+
+			u_int32_t length = _count_ones_from(digit, p, sizeof(vec_bytes));
+			if (p + length == sizeof(vec_bytes)) break;
+
+			u_int32_t value = 0;
+			for (u_int32_t k = p; k < p + length; k++) value = value * 10 + (text[k] - '0');
+			values[i++] = value;
+			p += length;
+		}
+
+		// a number as long as the whole vector
+		if (p == 0) {
+			text = _parse_ascii(text, end, values + i, 1);
+			if (text == NULL) return NULL;
+			i++;
+		}
+
+		text += p;
+	}
+
+	return _parse_ascii(text, end, values + i, count - i);
+}
+#else
+static char *KERNEL_NAME(kernel_parse_ascii)(char *text, char *end, u_int32_t *values, u_int32_t count) {
+	return _parse_ascii(text, end, values, count);
+}
+#endif
+
+/*
+ * Takes the even (or, with offset 1, the odd) samples of 2 vectors
+ * starting at the given pointer.
+ */
+#define _EVERY_OTHER(i, offset) (2 * (i) + (offset))
+
+static inline KERNEL_TARGET vec_u32 KERNEL_NAME(_load_every_other)(u_int32_t *samples, int offset) {
+	vec_u32 v0, v1;
+	memcpy(&v0, samples, sizeof(vec_u32));
+	memcpy(&v1, samples + VEC_LANES, sizeof(vec_u32));
+
+	if (offset == 0) return __builtin_shuffle(v0, v1, VEC_MASK(_EVERY_OTHER, 0));
+	return __builtin_shuffle(v0, v1, VEC_MASK(_EVERY_OTHER, 1));
+}
+
+/*
+ * Halves a pair of rows with a 2x2 box filter: every resulting pixel is the
+ * rounded average of a 2x2 block. When the width is odd, the last column is
+ * used twice.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_reduce_box_row)(u_int32_t *row0, u_int32_t *row1, u_int32_t *result,
+                                                           u_int32_t width) {
+	u_int32_t result_width = (width + 1) / 2;
+
+	u_int32_t x = 0;
+	for (; 2 * (x + VEC_LANES) <= width; x += VEC_LANES) {
+		vec_u32 sum = KERNEL_NAME(_load_every_other)(row0 + 2 * x, 0) + KERNEL_NAME(_load_every_other)(row0 + 2 * x, 1)
+		              + KERNEL_NAME(_load_every_other)(row1 + 2 * x, 0) + KERNEL_NAME(_load_every_other)(row1 + 2 * x, 1);
+		vec_u32 average = (sum + 2) >> 2;
+		memcpy(result + x, &average, sizeof(vec_u32));
+	}
+	for (; x < result_width; x++) {
+		u_int32_t right = 2 * x + 1 < width ? 2 * x + 1 : 2 * x;
+		result[x] = (row0[2 * x] + row0[right] + row1[2 * x] + row1[right] + 2) >> 2;
+	}
+}
+
+/*
+ * Halves five rows (centered at the row being reduced, repeated at the borders)
+ * with the 5x5 binomial filter [1 4 6 4 1] x [1 4 6 4 1] / 256, keeping every
+ * other column. The vertical part is done first into the scratch buffer, which
+ * must hold REDUCE_SCRATCH(width) integers.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_reduce_gaussian_row)(u_int32_t **rows, u_int32_t *result, u_int32_t width,
+                                                                u_int32_t *scratch) {
+	u_int32_t result_width = (width + 1) / 2;
+
+	// column i goes to scratch[i + 2], the borders are repeated
+	u_int32_t x = 0;
+	for (; x + VEC_LANES <= width; x += VEC_LANES) {
+		vec_u32 r[5];
+		for (int i = 0; i < 5; i++) memcpy(&r[i], rows[i] + x, sizeof(vec_u32));
+		vec_u32 sum = r[0] + 4 * r[1] + 6 * r[2] + 4 * r[3] + r[4];
+		memcpy(scratch + x + 2, &sum, sizeof(vec_u32));
+	}
+	for (; x < width; x++) {
+		scratch[x + 2] = rows[0][x] + 4 * rows[1][x] + 6 * rows[2][x] + 4 * rows[3][x] + rows[4][x];
+	}
+	scratch[0] = scratch[1] = scratch[2];
+	scratch[width + 2] = scratch[width + 3] = scratch[width + 1];
+
+	// horizontal part at the even columns, the last vector may stick out of
+	// the row, those lanes are computed on padding and thrown away
+	for (x = 0; x < result_width; x += VEC_LANES) {
+		u_int32_t *center = scratch + 2 * x + 2;
+		vec_u32 sum = KERNEL_NAME(_load_every_other)(center - 2, 0) + 4 * KERNEL_NAME(_load_every_other)(center - 2, 1)
+		              + 6 * KERNEL_NAME(_load_every_other)(center, 0) + 4 * KERNEL_NAME(_load_every_other)(center, 1)
+		              + KERNEL_NAME(_load_every_other)(center + 2, 0);
+		vec_u32 average = (sum + 128) >> 8;
+
+		u_int32_t lanes = result_width - x < VEC_LANES ? result_width - x : VEC_LANES;
+		memcpy(result + x, &average, lanes * sizeof(u_int32_t));
+	}
+}
+
+/*
+ * Puts the smaller of the two vectors into a and the larger into b,
+ * lane by lane: the comparator of the sorting networks
+ */
+static inline KERNEL_TARGET void KERNEL_NAME(_sort2)(vec_u32 *a, vec_u32 *b) {
+	vec_u32 low = KERNEL_NAME(_min_u32)(*a, *b);
+	*b = KERNEL_NAME(_max_u32)(*a, *b);
+	*a = low;
+}
+
+static inline KERNEL_TARGET vec_u32 KERNEL_NAME(_median3)(vec_u32 a, vec_u32 b, vec_u32 c) {
+	return KERNEL_NAME(_max_u32)(KERNEL_NAME(_min_u32)(a, b), KERNEL_NAME(_min_u32)(KERNEL_NAME(_max_u32)(a, b), c));
+}
+
+/*
+ * Sorts 3 or 5 vectors lane by lane with the optimal networks of 3 and 9 comparators
+ */
+static inline KERNEL_TARGET void KERNEL_NAME(_sort_network)(vec_u32 *v, u_int32_t count) {
+	if (count == 3) {
+		KERNEL_NAME(_sort2)(&v[0], &v[1]);
+		KERNEL_NAME(_sort2)(&v[1], &v[2]);
+		KERNEL_NAME(_sort2)(&v[0], &v[1]);
+		return;
+	}
+
+	KERNEL_NAME(_sort2)(&v[0], &v[1]);
+	KERNEL_NAME(_sort2)(&v[3], &v[4]);
+	KERNEL_NAME(_sort2)(&v[2], &v[4]);
+	KERNEL_NAME(_sort2)(&v[2], &v[3]);
+	KERNEL_NAME(_sort2)(&v[0], &v[3]);
+	KERNEL_NAME(_sort2)(&v[0], &v[2]);
+	KERNEL_NAME(_sort2)(&v[1], &v[4]);
+	KERNEL_NAME(_sort2)(&v[1], &v[3]);
+	KERNEL_NAME(_sort2)(&v[1], &v[2]);
+}
+
+/*
+ * Finds the median of an odd number of vectors lane by lane by forgetful
+ * selection: of any count / 2 + 2 values the smallest and the largest cannot
+ * be the median, so they are dropped and the next value takes their place
+ * until only three are left.
+ */
+static inline KERNEL_TARGET vec_u32 KERNEL_NAME(_select_median)(vec_u32 *v, u_int32_t count) {
+	vec_u32 window[MEDIAN_MAX_CANDIDATES];
+	u_int32_t size = count / 2 + 2, next = size;
+	memcpy(window, v, size * sizeof(vec_u32));
+
+	while (size > 3) {
+		for (u_int32_t i = 1; i < size; i++) KERNEL_NAME(_sort2)(&window[0], &window[i]);
+		for (u_int32_t i = 1; i + 1 < size; i++) KERNEL_NAME(_sort2)(&window[i], &window[size - 1]);
+
+		// the smallest is replaced by the last one left, the largest by the next value
+		window[0] = window[size - 2];
+		size -= 2;
+		if (next < count) window[size++] = v[next++];
+	}
+
+	return KERNEL_NAME(_median3)(window[0], window[1], window[2]);
+}
+
+/*
+ * Applies the median filter of the given radius (1 for 3x3, 2 for 5x5) to a
+ * row. rows holds the 2 * radius + 1 rows centered at it, repeated at the
+ * borders of the image as are the columns.
+ *
+ * First every column of the window is sorted once, so that the windows of the
+ * neighboring pixels share the work. Then, with the columns sorted, the 3x3
+ * median is the median of the largest of the minimums, the median of the
+ * medians and the smallest of the maximums. For 5x5 the ranks are sorted across
+ * the columns as well, after which only 13 of the 25 values can be the median,
+ * the other 12 being known to lie on either side of it in equal numbers.
+ *
+ * The scratch buffer must hold MEDIAN_SCRATCH(width, radius) integers.
+ */
+static KERNEL_TARGET void KERNEL_NAME(kernel_median_row)(u_int32_t **rows, u_int32_t *result, u_int32_t width,
+                                                       u_int32_t radius, u_int32_t *scratch) {
+	u_int32_t size = 2 * radius + 1;
+	u_int32_t stride = width + 2 * radius + KERNEL_MAX_LANES;
+
+	// first step: rank i of column x goes to scratch[i * stride + x + radius]
+	u_int32_t x = 0;
+	for (; x < width; x += VEC_LANES) {
+		vec_u32 column[2 * MEDIAN_MAX_RADIUS + 1];
+		u_int32_t lanes = width - x < VEC_LANES ? width - x : VEC_LANES;
+		for (u_int32_t i = 0; i < size; i++) {
+			column[i] = (vec_u32) {};
+			memcpy(&column[i], rows[i] + x, lanes * sizeof(u_int32_t));
+		}
+
+		KERNEL_NAME(_sort_network)(column, size);
+		for (u_int32_t i = 0; i < size; i++) memcpy(scratch + i * stride + x + radius, &column[i], sizeof(vec_u32));
+	}
+	for (u_int32_t i = 0; i < size; i++) {
+		u_int32_t *ranks = scratch + i * stride;
+		for (u_int32_t k = 0; k < radius; k++) {
+			ranks[k] = ranks[radius];
+			ranks[width + radius + k] = ranks[width + radius - 1];
+		}
+	}
+
+	// second step: the windows, the last vector may stick out of the row,
+	// those lanes are computed on padding and thrown away
+	for (x = 0; x < width; x += VEC_LANES) {
+		vec_u32 median;
+		if (radius == 1) {
+			vec_u32 low[3], middle[3], high[3];
+			for (u_int32_t k = 0; k < 3; k++) {
+				memcpy(&low[k], scratch + x + k, sizeof(vec_u32));
+				memcpy(&middle[k], scratch + stride + x + k, sizeof(vec_u32));
+				memcpy(&high[k], scratch + 2 * stride + x + k, sizeof(vec_u32));
+			}
+
+			vec_u32 largest_low = KERNEL_NAME(_max_u32)(KERNEL_NAME(_max_u32)(low[0], low[1]), low[2]);
+			vec_u32 smallest_high = KERNEL_NAME(_min_u32)(KERNEL_NAME(_min_u32)(high[0], high[1]), high[2]);
+			median = KERNEL_NAME(_median3)(largest_low, KERNEL_NAME(_median3)(middle[0], middle[1], middle[2]), smallest_high);
+		} else {
+			vec_u32 ranks[5][5];
+			for (u_int32_t i = 0; i < 5; i++) {
+				for (u_int32_t k = 0; k < 5; k++) memcpy(&ranks[i][k], scratch + i * stride + x + k, sizeof(vec_u32));
+				KERNEL_NAME(_sort_network)(ranks[i], 5);
+			}
+
+			// value (i, j) has at least (i + 1)(j + 1) values below or equal and
+			// (5 - i)(5 - j) above or equal, the candidates are the ones where neither is over 13
+			vec_u32 candidates[MEDIAN_MAX_CANDIDATES] = {
+				ranks[0][3], ranks[0][4],
+				ranks[1][2], ranks[1][3], ranks[1][4],
+				ranks[2][1], ranks[2][2], ranks[2][3],
+				ranks[3][0], ranks[3][1], ranks[3][2],
+				ranks[4][0], ranks[4][1]};
+			median = KERNEL_NAME(_select_median)(candidates, MEDIAN_MAX_CANDIDATES);
+		}
+
+		u_int32_t lanes = width - x < VEC_LANES ? width - x : VEC_LANES;
+		memcpy(result + x, &median, lanes * sizeof(u_int32_t));
+	}
+}
+
+/*
+ * Points all the kernels at the ones of this tier
+ */
+static void KERNEL_NAME(_bind_kernels)(void) {
+	kernel_rgb_to_grayscale = KERNEL_NAME(kernel_rgb_to_grayscale);
+	kernel_sobel_rgb_row = KERNEL_NAME(kernel_sobel_rgb_row);
+	kernel_sobel_grayscale_row = KERNEL_NAME(kernel_sobel_grayscale_row);
+	kernel_threshold_row = KERNEL_NAME(kernel_threshold_row);
+	kernel_pack_samples = KERNEL_NAME(kernel_pack_samples);
+	kernel_unpack_samples = KERNEL_NAME(kernel_unpack_samples);
+	kernel_rows_differ = KERNEL_NAME(kernel_rows_differ);
+	kernel_parse_ascii = KERNEL_NAME(kernel_parse_ascii);
+	kernel_reduce_box_row = KERNEL_NAME(kernel_reduce_box_row);
+	kernel_reduce_gaussian_row = KERNEL_NAME(kernel_reduce_gaussian_row);
+	kernel_median_row = KERNEL_NAME(kernel_median_row);
+}
+
+#undef vec_u32
+#undef vec_i32
+#undef vec_f32
+#undef vec_u8
+#undef vec_bytes
+#undef VEC_LANES
+#undef VEC_MASK
+#undef KERNEL_NAME
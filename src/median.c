@@ -0,0 +1,170 @@
+#include "median.h"
+#include "kernels.h"
+#include "threads.h"
+
+/*
+ * Filters row y of the image into the result, repeating the rows at the
+ * top and the bottom of the image.
+ */
+static void _median_row(struct grayscale_image *image, u_int32_t y, u_int32_t radius, u_int32_t *result,
+                        u_int32_t *scratch) {
+	u_int32_t *rows[2 * MEDIAN_MAX_RADIUS + 1];
+	for (u_int32_t i = 0; i < 2 * radius + 1; i++) {
+		int64_t row = (int64_t) y + i - radius;
+		if (row < 0) row = 0;
+		if (row >= image->height) row = image->height - 1;
+		rows[i] = image->matrix[row];
+	}
+
+	kernel_median_row(rows, result, image->width, radius, scratch);
+}
+
+/*
+ * Runs the threads over all the rows of the source.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+static int _run_median_pass(struct grayscale_image *image, struct grayscale_image *result, u_int32_t radius, int sobel,
+                            int threads) {
+	if (threads < 1) {
+		printf("<median>: number of threads cannot be less than one.\n");
+		return -1;
+	}
+
+	if (image == NULL || result == NULL) {
+		printf("<median>: met NULL instead of an existing image.\n");
+		return -1;
+	}
+
+	if (radius < 1 || radius > MEDIAN_MAX_RADIUS) {
+		printf("<median>: only 3x3 and 5x5 windows are supported.\n");
+		return -1;
+	}
+
+	if (image->width != result->width || image->height != result->height) {
+		printf("<median>: the result must be as large as the image.\n");
+		return -1;
+	}
+
+	struct median_task task = {.source_image = image, .destination_image = result, .radius = radius, .sobel = sobel};
+	return run_row_bands(image->height, threads, _median_filter_thread_job, (void *) &task);
+}
+
+/*
+ * Removes salt-and-pepper noise from the given grayscale image with a median
+ * filter of the given radius: 1 for a 3x3 window, 2 for a 5x5 one.
+ *
+ * Returns NULL in case of an error or a pointer to the filtered image.
+ */
+struct grayscale_image *median_filter_grayscale(struct grayscale_image *image, u_int32_t radius, int threads) {
+	if (image == NULL) {
+		printf("<median>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct grayscale_image *result = create_grayscale_image(image->width, image->height, image->scale);
+	if (_run_median_pass(image, result, radius, 0, threads) != 0) {
+		free_grayscale_image(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+/*
+ * Applies the sobel operator to the median filtered image in one pass, as
+ * sobel_filter_grayscale(median_filter_grayscale(image)) but without the
+ * filtered image: every thread keeps only the three filtered rows the sobel
+ * operator needs.
+ *
+ * Returns NULL in case of an error or a pointer to the resulting image.
+ */
+struct grayscale_image *sobel_filter_median(struct grayscale_image *image, u_int32_t radius, int threads) {
+	if (image == NULL) {
+		printf("<median>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct grayscale_image *result = create_grayscale_image(image->width, image->height, image->scale);
+	if (sobel_filter_median_into(image, result, radius, threads) != 0) {
+		free_grayscale_image(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+/*
+ * Same as sobel_filter_median, but writes into an existing image of the same
+ * size, as sobel_filter_grayscale_into does.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int sobel_filter_median_into(struct grayscale_image *image, struct grayscale_image *result, u_int32_t radius, int threads) {
+	printf("<median>: launching threads...\n");
+	int status = _run_median_pass(image, result, radius, 1, threads);
+	if (status == 0) printf("<median>: all threads have finished.\n");
+
+	return status;
+}
+
+/*
+ * A helper function for the median filter. Filters the band of rows given in
+ * the row_band_task. For the sobel operator the filtered rows go around three
+ * buffers, row y in buffer y % 3, and the rows just outside of the band are
+ * filtered as well.
+ *
+ * Returns NULL.
+ */
+void *_median_filter_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct median_task *task = (struct median_task *) band->context;
+	struct grayscale_image *image = task->source_image;
+	struct grayscale_image *result = task->destination_image;
+
+	u_int32_t *scratch = (u_int32_t *) calloc(MEDIAN_SCRATCH(image->width, task->radius), sizeof(u_int32_t));
+
+	if (!task->sobel) {
+		for (u_int32_t y = band->from; y < band->to; y++) _median_row(image, y, task->radius, result->matrix[y], scratch);
+		free(scratch);
+		return NULL;
+	}
+
+	int32_t *sobel_scratch = (int32_t *) calloc(SOBEL_GRAYSCALE_SCRATCH(image->width), sizeof(int32_t));
+	u_int32_t *filtered[3];
+	for (int i = 0; i < 3; i++) filtered[i] = (u_int32_t *) malloc(image->width * sizeof(u_int32_t));
+
+	if (band->from > 0) _median_row(image, band->from - 1, task->radius, filtered[(band->from - 1) % 3], scratch);
+	_median_row(image, band->from, task->radius, filtered[band->from % 3], scratch);
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		u_int32_t *below = NULL;
+		if (y + 1 < image->height) {
+			below = filtered[(y + 1) % 3];
+			_median_row(image, y + 1, task->radius, below, scratch);
+		}
+		u_int32_t *above = y > 0 ? filtered[(y - 1) % 3] : NULL;
+
+		kernel_sobel_grayscale_row(above, filtered[y % 3], below, result->matrix[y],
+		                           0, image->width, image->width, image->scale, sobel_scratch);
+	}
+
+	for (int i = 0; i < 3; i++) free(filtered[i]);
+	free(sobel_scratch);
+	free(scratch);
+
+	return NULL;
+}
+
+/*
+ * Parses the size of the median window, 3 or 5.
+ *
+ * Returns -1 if the size is not supported, otherwise returns 0 and the radius of the window.
+ */
+int parse_median_size(char *text, u_int32_t *radius) {
+	if (strcmp(text, "3") == 0) *radius = 1;
+	else if (strcmp(text, "5") == 0) *radius = 2;
+	else return -1;
+
+	return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef OMP_MEDIAN_H
+#define OMP_MEDIAN_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* STRUCTURES */
+
+/*
+ * Contains the data shared by the threads of the median filter. Every row of
+ * the source is filtered with a window of 2 * radius + 1 pixels on each side,
+ * repeated at the borders. With sobel set, the filtered rows are not stored
+ * but go through the sobel operator into destination_image right away.
+ */
+struct median_task {
+    struct grayscale_image *source_image, *destination_image;
+    u_int32_t radius;
+    int sobel;
+};
+
+/* FUNCTIONS */
+
+/* Helpers */
+void *_median_filter_thread_job(void *data);
+int parse_median_size(char *text, u_int32_t *radius);
+
+/* Denoising */
+struct grayscale_image *median_filter_grayscale(struct grayscale_image *image, u_int32_t radius, int threads);
+struct grayscale_image *sobel_filter_median(struct grayscale_image *image, u_int32_t radius, int threads);
+int sobel_filter_median_into(struct grayscale_image *image, struct grayscale_image *result, u_int32_t radius, int threads);
+
+#endif // OMP_MEDIAN_H
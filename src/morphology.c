@@ -0,0 +1,356 @@
+#include "morphology.h"
+#include "threads.h"
+
+/*
+ * The pixels of the last word of a row, all of them when the width
+ * is a multiple of the word.
+ *
+ * Returns the mask of the pixels.
+ */
+static u_int64_t _get_last_word_mask(u_int32_t width) {
+	u_int32_t bits = width % MORPHOLOGY_WORD_BITS;
+	return bits == 0 ? ~(u_int64_t) 0 : ((u_int64_t) 1 << bits) - 1;
+}
+
+/*
+ * Reads word i of a row, the words outside of the row and the bits after
+ * its last pixel are filled with the given value.
+ *
+ * Returns the word.
+ */
+static inline u_int64_t _load_word(u_int64_t *row, int64_t i, u_int32_t words, u_int64_t last_mask, u_int64_t fill) {
+	if (i < 0 || i >= words) return fill;
+	if (i == words - 1) return (row[i] & last_mask) | (fill & ~last_mask);
+	return row[i];
+}
+
+/*
+ * Combines every pixel of the row with the radius pixels on each side of it,
+ * by OR for the dilation and by AND for the erosion. Shifting a word by k
+ * moves its pixels k places along the row, the pixels that leave the word
+ * come from the neighbouring one.
+ */
+static void _morph_row(u_int64_t *row, u_int64_t *result, u_int32_t width, u_int32_t words, int operation,
+                       u_int32_t radius) {
+	u_int64_t last_mask = _get_last_word_mask(width);
+	u_int64_t fill = operation == MORPHOLOGY_ERODE ? ~(u_int64_t) 0 : 0;
+
+	u_int64_t previous = fill, current = _load_word(row, 0, words, last_mask, fill);
+	for (u_int32_t i = 0; i < words; i++) {
+		u_int64_t next = _load_word(row, (int64_t) i + 1, words, last_mask, fill);
+
+		u_int64_t word = current;
+		for (u_int32_t k = 1; k <= radius; k++) {
+			u_int64_t from_left = (current << k) | (previous >> (MORPHOLOGY_WORD_BITS - k));
+			u_int64_t from_right = (current >> k) | (next << (MORPHOLOGY_WORD_BITS - k));
+			if (operation == MORPHOLOGY_ERODE) word &= from_left & from_right;
+			else word |= from_left | from_right;
+		}
+		result[i] = word;
+
+		previous = current;
+		current = next;
+	}
+
+	result[words - 1] &= last_mask;
+}
+
+/*
+ * Creates a new packed black and white image with all the pixels at zero.
+ *
+ * Returns a pointer to the image.
+ */
+struct packed_blackwhite_image *create_packed_blackwhite_image(u_int32_t width, u_int32_t height) {
+	struct packed_blackwhite_image *image = (struct packed_blackwhite_image *) malloc(sizeof(struct packed_blackwhite_image));
+	image->width = width;
+	image->height = height;
+	image->words = (width + MORPHOLOGY_WORD_BITS - 1) / MORPHOLOGY_WORD_BITS;
+
+	image->matrix = (u_int64_t **) calloc(height, sizeof(u_int64_t *));
+	for (u_int32_t y = 0; y < height; y++) image->matrix[y] = (u_int64_t *) calloc(image->words, sizeof(u_int64_t));
+
+	return image;
+}
+
+/*
+ * Runs the threads converting between the two forms of the image.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+static int _run_packing(struct blackwhite_image *image, struct packed_blackwhite_image *packed_image, int unpack,
+                        int threads) {
+	if (threads < 1) {
+		printf("<morphology>: number of threads cannot be less than one.\n");
+		return -1;
+	}
+
+	if (image == NULL || packed_image == NULL) {
+		printf("<morphology>: met NULL instead of an existing image.\n");
+		return -1;
+	}
+
+	if (image->width != packed_image->width || image->height != packed_image->height) {
+		printf("<morphology>: the packed image must be as large as the image.\n");
+		return -1;
+	}
+
+	struct packing_task task = {.image = image, .packed_image = packed_image, .unpack = unpack};
+	return run_row_bands(image->height, threads, _packing_thread_job, (void *) &task);
+}
+
+/*
+ * Packs the pixels of the black and white image into words, 64 in each.
+ *
+ * Returns NULL in case of an error or a pointer to the packed image.
+ */
+struct packed_blackwhite_image *pack_blackwhite_image(struct blackwhite_image *image, int threads) {
+	if (image == NULL) {
+		printf("<morphology>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct packed_blackwhite_image *result = create_packed_blackwhite_image(image->width, image->height);
+	if (_run_packing(image, result, 0, threads) != 0) {
+		free_packed_blackwhite_image(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+/*
+ * Writes the pixels of the packed image back into a black
+ * and white image of the same size, one byte for each.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int unpack_blackwhite_image(struct packed_blackwhite_image *packed_image, struct blackwhite_image *image, int threads) {
+	return _run_packing(image, packed_image, 1, threads);
+}
+
+/*
+ * Frees the rows of the packed image and the image itself.
+ */
+void free_packed_blackwhite_image(struct packed_blackwhite_image *image) {
+	for (u_int32_t y = 0; y < image->height; y++) free(image->matrix[y]);
+	free(image->matrix);
+	free(image);
+}
+
+/*
+ * Dilates or erodes the packed image into the result, another packed image
+ * of the same size, with a square of 2 * radius + 1 pixels on each side.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int morph_packed_image(struct packed_blackwhite_image *image, struct packed_blackwhite_image *result, int operation,
+                       u_int32_t radius, int threads) {
+	if (threads < 1) {
+		printf("<morphology>: number of threads cannot be less than one.\n");
+		return -1;
+	}
+
+	if (image == NULL || result == NULL) {
+		printf("<morphology>: met NULL instead of an existing image.\n");
+		return -1;
+	}
+
+	if (operation != MORPHOLOGY_DILATE && operation != MORPHOLOGY_ERODE) {
+		printf("<morphology>: only the dilation and the erosion work on their own.\n");
+		return -1;
+	}
+
+	if (radius < 1 || radius > MORPHOLOGY_MAX_RADIUS) {
+		printf("<morphology>: the radius must be from 1 to %d.\n", MORPHOLOGY_MAX_RADIUS);
+		return -1;
+	}
+
+	if (image->width != result->width || image->height != result->height) {
+		printf("<morphology>: the result must be as large as the image.\n");
+		return -1;
+	}
+
+	struct morphology_task task = {.source_image = image, .destination_image = result, .operation = operation,
+	                               .radius = radius};
+	return run_row_bands(image->height, threads, _morphology_thread_job, (void *) &task);
+}
+
+/*
+ * Runs the stages one after another on the black and white image, in place.
+ * The image is packed once, every dilation or erosion goes from one packed
+ * image into the other, and the last one is unpacked into the image.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int apply_morphology_stages(struct blackwhite_image *image, struct morphology_stage *stages, u_int32_t count, int threads) {
+	struct packed_blackwhite_image *packed = pack_blackwhite_image(image, threads);
+	if (packed == NULL) return -1;
+	struct packed_blackwhite_image *spare = create_packed_blackwhite_image(image->width, image->height);
+
+	printf("<morphology>: launching threads...\n");
+
+	int status = 0;
+	for (u_int32_t i = 0; i < count && status == 0; i++) {
+		int steps[2] = {stages[i].operation, 0};
+		if (stages[i].operation == MORPHOLOGY_OPEN) {
+			steps[0] = MORPHOLOGY_ERODE;
+			steps[1] = MORPHOLOGY_DILATE;
+		} else if (stages[i].operation == MORPHOLOGY_CLOSE) {
+			steps[0] = MORPHOLOGY_DILATE;
+			steps[1] = MORPHOLOGY_ERODE;
+		}
+
+		for (int j = 0; j < 2 && steps[j] != 0 && status == 0; j++) {
+			status = morph_packed_image(packed, spare, steps[j], stages[i].radius, threads);
+
+			struct packed_blackwhite_image *swap = packed;
+			packed = spare;
+			spare = swap;
+		}
+	}
+
+	if (status == 0) status = unpack_blackwhite_image(packed, image, threads);
+	if (status == 0) printf("<morphology>: all threads have finished.\n");
+
+	free_packed_blackwhite_image(packed);
+	free_packed_blackwhite_image(spare);
+
+	return status;
+}
+
+/*
+ * A helper function for the packing. Packs or unpacks the band
+ * of rows given in the row_band_task.
+ *
+ * Returns NULL.
+ */
+void *_packing_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct packing_task *task = (struct packing_task *) band->context;
+	struct blackwhite_image *image = task->image;
+	struct packed_blackwhite_image *packed_image = task->packed_image;
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		u_int8_t *pixels = image->matrix[y];
+		u_int64_t *words = packed_image->matrix[y];
+
+		for (u_int32_t i = 0; i < packed_image->words; i++) {
+			u_int32_t start = i * MORPHOLOGY_WORD_BITS;
+			u_int32_t bits = image->width - start < MORPHOLOGY_WORD_BITS ? image->width - start : MORPHOLOGY_WORD_BITS;
+
+			if (task->unpack) {
+				u_int64_t word = words[i];
+				for (u_int32_t b = 0; b < bits; b++) pixels[start + b] = (word >> b) & 1;
+			} else {
+				u_int64_t word = 0;
+				for (u_int32_t b = 0; b < bits; b++) word |= (u_int64_t) (pixels[start + b] != 0) << b;
+				words[i] = word;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * A helper function for the morphology. Dilates or erodes the band of rows
+ * given in the row_band_task. The rows combined along themselves go around
+ * 2 * radius + 1 buffers, row y in buffer y % (2 * radius + 1), and the
+ * radius rows on each side of the band are combined as well.
+ *
+ * Returns NULL.
+ */
+void *_morphology_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct morphology_task *task = (struct morphology_task *) band->context;
+	struct packed_blackwhite_image *image = task->source_image;
+	struct packed_blackwhite_image *result = task->destination_image;
+	u_int32_t radius = task->radius;
+	u_int32_t span = 2 * radius + 1;
+
+	u_int64_t *rows = (u_int64_t *) malloc((size_t) span * image->words * sizeof(u_int64_t));
+	u_int64_t fill = task->operation == MORPHOLOGY_ERODE ? ~(u_int64_t) 0 : 0;
+
+	// the rows above the first row of the band and the ones below it but the last
+	u_int32_t first = band->from > radius ? band->from - radius : 0;
+	for (u_int32_t y = first; y < band->from + radius && y < image->height; y++) {
+		_morph_row(image->matrix[y], rows + (size_t) (y % span) * image->words, image->width, image->words,
+		           task->operation, radius);
+	}
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		if (y + radius < image->height) {
+			_morph_row(image->matrix[y + radius], rows + (size_t) ((y + radius) % span) * image->words, image->width,
+			           image->words, task->operation, radius);
+		}
+
+		u_int32_t top = y > radius ? y - radius : 0;
+		u_int32_t bottom = y + radius < image->height ? y + radius : image->height - 1;
+		u_int64_t *target = result->matrix[y];
+		for (u_int32_t i = 0; i < image->words; i++) target[i] = fill;
+
+		for (u_int32_t row = top; row <= bottom; row++) {
+			u_int64_t *source = rows + (size_t) (row % span) * image->words;
+			if (task->operation == MORPHOLOGY_ERODE) {
+				for (u_int32_t i = 0; i < image->words; i++) target[i] &= source[i];
+			} else {
+				for (u_int32_t i = 0; i < image->words; i++) target[i] |= source[i];
+			}
+		}
+	}
+
+	free(rows);
+
+	return NULL;
+}
+
+/*
+ * Parses the stages given as OPERATION[:RADIUS],... where the operation is
+ * dilate, erode, open or close and the radius is 1 by default, for a 3x3 square.
+ *
+ * Returns -1 if the text is not a correct list of stages, otherwise returns 0,
+ * the stages to be freed and their count.
+ */
+int parse_morphology_stages(char *text, struct morphology_stage **stages, u_int32_t *count) {
+	char *copy = strdup(text);
+	u_int32_t capacity = 1;
+	for (char *c = copy; *c != '\0'; c++) if (*c == ',') capacity++;
+
+	struct morphology_stage *result = (struct morphology_stage *) calloc(capacity, sizeof(struct morphology_stage));
+	u_int32_t length = 0;
+
+	char *saved = NULL;
+	for (char *item = strtok_r(copy, ",", &saved); item != NULL; item = strtok_r(NULL, ",", &saved)) {
+		struct morphology_stage stage = {.operation = -1, .radius = 1};
+
+		char *colon = strchr(item, ':');
+		if (colon != NULL) {
+			char end;
+			int radius;
+			if (sscanf(colon + 1, "%d%c", &radius, &end) != 1 || radius < 1 || radius > MORPHOLOGY_MAX_RADIUS) break;
+			stage.radius = radius;
+			*colon = '\0';
+		}
+
+		if (strcmp(item, "dilate") == 0) stage.operation = MORPHOLOGY_DILATE;
+		else if (strcmp(item, "erode") == 0) stage.operation = MORPHOLOGY_ERODE;
+		else if (strcmp(item, "open") == 0) stage.operation = MORPHOLOGY_OPEN;
+		else if (strcmp(item, "close") == 0) stage.operation = MORPHOLOGY_CLOSE;
+		else break;
+
+		result[length++] = stage;
+	}
+
+	// every item between the commas must have become a stage
+	int correct = length == capacity;
+	free(copy);
+	if (!correct) {
+		free(result);
+		return -1;
+	}
+
+	*stages = result;
+	*count = length;
+
+	return 0;
+}
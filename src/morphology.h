@@ -0,0 +1,84 @@
+#ifndef OMP_MORPHOLOGY_H
+#define OMP_MORPHOLOGY_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* DEFINES */
+
+#define MORPHOLOGY_DILATE 1
+#define MORPHOLOGY_ERODE 2
+#define MORPHOLOGY_OPEN 3 // erode, then dilate
+#define MORPHOLOGY_CLOSE 4 // dilate, then erode
+
+/*
+ * The square of a stage is 2 * radius + 1 pixels on each side, the shifts
+ * of a word by up to radius bits must stay below the width of the word
+ */
+#define MORPHOLOGY_MAX_RADIUS 16
+
+#define MORPHOLOGY_WORD_BITS 64
+
+/* STRUCTURES */
+
+/*
+ * A black and white image with 64 pixels in every word of a row: pixel x is
+ * bit x % 64 of word x / 64. The bits after the last pixel of a row are zero.
+ */
+struct packed_blackwhite_image {
+    u_int32_t width;
+    u_int32_t height;
+    u_int32_t words; // in every row
+    u_int64_t **matrix;
+};
+
+/*
+ * One stage of the morphology pipeline, an operation with a square of
+ * 2 * radius + 1 pixels on each side.
+ */
+struct morphology_stage {
+    int operation;
+    u_int32_t radius;
+};
+
+/*
+ * Contains the data shared by the threads converting between the bytes of a
+ * black and white image and its packed rows, in the direction given by unpack.
+ */
+struct packing_task {
+    struct blackwhite_image *image;
+    struct packed_blackwhite_image *packed_image;
+    int unpack;
+};
+
+/*
+ * Contains the data shared by the threads dilating or eroding a packed image.
+ * The square is separable: every thread combines the shifted words of a row
+ * first and then the combined rows around each row of its band. The pixels
+ * outside of the image never change the result, they are 0 for the dilation
+ * and 1 for the erosion.
+ */
+struct morphology_task {
+    struct packed_blackwhite_image *source_image, *destination_image;
+    int operation; // MORPHOLOGY_DILATE or MORPHOLOGY_ERODE
+    u_int32_t radius;
+};
+
+/* FUNCTIONS */
+
+/* Helpers */
+void *_packing_thread_job(void *data);
+void *_morphology_thread_job(void *data);
+int parse_morphology_stages(char *text, struct morphology_stage **stages, u_int32_t *count);
+
+/* Packing */
+struct packed_blackwhite_image *create_packed_blackwhite_image(u_int32_t width, u_int32_t height);
+struct packed_blackwhite_image *pack_blackwhite_image(struct blackwhite_image *image, int threads);
+int unpack_blackwhite_image(struct packed_blackwhite_image *packed_image, struct blackwhite_image *image, int threads);
+void free_packed_blackwhite_image(struct packed_blackwhite_image *image);
+
+/* Morphology */
+int morph_packed_image(struct packed_blackwhite_image *image, struct packed_blackwhite_image *result, int operation,
+                       u_int32_t radius, int threads);
+int apply_morphology_stages(struct blackwhite_image *image, struct morphology_stage *stages, u_int32_t count, int threads);
+
+#endif // OMP_MORPHOLOGY_H
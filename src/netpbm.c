@@ -1,4 +1,8 @@
 #include "netpbm.h"
+#include "kernels.h"
+#include "threads.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /*
  * Allocates memory for the given dimensions of an RGB image.
@@ -61,6 +65,21 @@ struct grayscale_image *create_grayscale_image(u_int32_t width, u_int32_t height
 	return image;
 }
 
+/*
+ * Allocates a new grayscale image of the same dimensions and copies the pixels.
+ *
+ * Returns a pointer to the copy.
+ */
+struct grayscale_image *copy_grayscale_image(struct grayscale_image *image) {
+	struct grayscale_image *copy = create_grayscale_image(image->width, image->height, image->scale);
+
+	for (u_int32_t y = 0; y < image->height; y++) {
+		memcpy(copy->matrix[y], image->matrix[y], image->width * sizeof(u_int32_t));
+	}
+
+	return copy;
+}
+
 /*
  * Completely frees the allocated memory for the grayscale image structure
  */
@@ -74,6 +93,70 @@ void free_grayscale_image(struct grayscale_image *image) {
 	free(image);
 }
 
+/*
+ * Allocates memory for a pyramid of grayscale images, level 0 having the given
+ * dimensions and every next level half of the previous one, rounded up. There
+ * are fewer levels than requested if the last one would be smaller than 1x1.
+ * All the pixels are allocated at once, the levels are ordinary grayscale_image
+ * structures pointing into that memory, so they must not be freed on their own.
+ *
+ * Returns NULL if the memory cannot be allocated or a pointer to the grayscale_pyramid structure.
+ */
+struct grayscale_pyramid *create_grayscale_pyramid(u_int32_t width, u_int32_t height, u_int32_t scale, u_int32_t count) {
+	// there are no levels after 1x1
+	u_int32_t available = 1;
+	for (u_int32_t w = width, h = height; w > 1 || h > 1; w = (w + 1) / 2, h = (h + 1) / 2) available++;
+	if (count > available) count = available;
+
+	struct grayscale_pyramid *pyramid = (struct grayscale_pyramid *) calloc(1, sizeof(struct grayscale_pyramid));
+	pyramid->levels = (struct grayscale_image *) calloc(count, sizeof(struct grayscale_image));
+	if (pyramid->levels == NULL) {
+		free_grayscale_pyramid(pyramid);
+		return NULL;
+	}
+
+	// find the dimensions of all the levels and how much memory they need
+	u_int64_t pixels = 0, rows = 0;
+	pyramid->count = 0;
+	for (u_int32_t w = width, h = height; pyramid->count < count; w = (w + 1) / 2, h = (h + 1) / 2) {
+		pyramid->levels[pyramid->count++] = (struct grayscale_image) {.width = w, .height = h, .scale = scale};
+		pixels += (u_int64_t) w * h;
+		rows += h;
+	}
+
+	pyramid->pixels = (u_int32_t *) calloc(pixels, sizeof(u_int32_t));
+	pyramid->rows = (u_int32_t **) malloc(rows * sizeof(u_int32_t *));
+	if (pyramid->pixels == NULL || pyramid->rows == NULL) {
+		free_grayscale_pyramid(pyramid);
+		return NULL;
+	}
+
+	// hand out the memory to the levels
+	u_int32_t *next_pixel = pyramid->pixels;
+	u_int32_t **next_row = pyramid->rows;
+	for (u_int32_t i = 0; i < pyramid->count; i++) {
+		struct grayscale_image *level = &pyramid->levels[i];
+		level->matrix = next_row;
+		for (u_int32_t y = 0; y < level->height; y++) {
+			level->matrix[y] = next_pixel;
+			next_pixel += level->width;
+		}
+		next_row += level->height;
+	}
+
+	return pyramid;
+}
+
+/*
+ * Completely frees the allocated memory for the pyramid, including its levels
+ */
+void free_grayscale_pyramid(struct grayscale_pyramid *pyramid) {
+	free(pyramid->pixels);
+	free(pyramid->rows);
+	free(pyramid->levels);
+	free(pyramid);
+}
+
 /*
 * Allocates memory for the given dimensions of a grayscale image.
 *
@@ -118,18 +201,63 @@ void free_blackwhite_image(struct blackwhite_image *image) {
  * Returns a pointer to the resulting grayscale_image structure.
  */
 struct grayscale_image *rgb_to_grayscale_image(struct rgb_image *image) {
+	return convert_rgb_to_grayscale(image, GRAYSCALE_AVERAGE, 1);
+}
+
+/*
+ * Converts the RGB image to grayscale using the given mode: the plain average
+ * of the channels or the BT.601 / BT.709 luma weights. The rows are divided
+ * between the given number of threads.
+ *
+ * Returns NULL in case of an error or a pointer to the resulting grayscale_image structure.
+ */
+struct grayscale_image *convert_rgb_to_grayscale(struct rgb_image *image, int mode, int threads) {
+	if (image == NULL) {
+		printf("<netpbm>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
 	struct grayscale_image *result = create_grayscale_image(image->width, image->height, image->scale);
 
-	for (u_int32_t y = 0; y < image->height; y++) {
-		for (u_int32_t x = 0; x < image->width; x++) {
-			u_int32_t average = (image->matrix[y][x].r + image->matrix[y][x].g + image->matrix[y][x].b) / 3;
-			result->matrix[y][x] = average;
-		}
+	struct grayscale_conversion_task task = {.source_image = image, .destination_image = result, .mode = mode};
+	if (run_row_bands(image->height, threads, _convert_rgb_to_grayscale_thread_job, (void *) &task) != 0) {
+		free_grayscale_image(result);
+		return NULL;
 	}
 
 	return result;
 }
 
+/*
+ * A helper function for the multithreaded conversion. Converts the band
+ * of rows given in the row_band_task.
+ *
+ * Returns NULL.
+ */
+static void *_convert_rgb_to_grayscale_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct grayscale_conversion_task *task = (struct grayscale_conversion_task *) band->context;
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		kernel_rgb_to_grayscale(task->source_image->matrix[y], task->destination_image->matrix[y],
+		                        task->source_image->width, task->source_image->scale, task->mode);
+	}
+
+	return NULL;
+}
+
+/*
+ * Maps the name of a grayscale conversion mode: "average", "bt601" or "bt709".
+ *
+ * Returns -1 if the name is unknown, otherwise returns the mode.
+ */
+int get_grayscale_mode(char *name) {
+	if (strcmp(name, "average") == 0) return GRAYSCALE_AVERAGE;
+	if (strcmp(name, "bt601") == 0) return GRAYSCALE_BT601;
+	if (strcmp(name, "bt709") == 0) return GRAYSCALE_BT709;
+	return -1;
+}
+
 /*
  * Skips comments if they are present on the way to a number
  *
@@ -141,7 +269,10 @@ static int _skip_comment(FILE *stream) {
 		if (c == '#') while (((char) (c = fgetc(stream))) != '\n' && c != EOF);
 		if (c == EOF) return EOF;
 	}
-	fseek(stream, -1, SEEK_CUR);
+	if (c == EOF) return EOF;
+
+	// put the digit back, unlike seeking this works on pipes too
+	ungetc(c, stream);
 	return 0;
 }
 
@@ -152,7 +283,7 @@ static int _skip_comment(FILE *stream) {
  * Returns -1 if error occurred, otherwise returns 0.
  */
 static int _read_header(FILE *stream, int *version, u_int32_t *width, u_int32_t *height, u_int32_t *scale) {
-	char image_version_str[3];
+	char image_version_str[3] = "";
 	int items_read = fscanf(stream, "%2s", image_version_str);
 
 	// check for the specified format
@@ -176,6 +307,7 @@ static int _read_header(FILE *stream, int *version, u_int32_t *width, u_int32_t
 
 	if (*version == NETPBM_BLACKWHITE_ASCII || *version == NETPBM_BLACKWHITE_BINARY) {
 		*scale = 1;
+		if (*version == NETPBM_BLACKWHITE_BINARY) fgetc(stream);
 		return 0;
 	}
 
@@ -185,6 +317,9 @@ static int _read_header(FILE *stream, int *version, u_int32_t *width, u_int32_t
 		return -1;
 	}
 
+	// binary bodies start right after a single whitespace character
+	if (*version >= NETPBM_BLACKWHITE_BINARY) fgetc(stream);
+
 	return 0;
 }
 
@@ -209,11 +344,6 @@ static int _get_netpbm_version(char *image_version) {
  * structure is returned.
  */
 struct image_file *open_image_file(char *file_path) {
-	// defining variables we'll need
-	char image_version[3];
-	u_int32_t width, height, scale;
-	int version;
-
 	// opening the file
 	FILE *stream = fopen(file_path, "r");
 	if (stream == NULL) {
@@ -222,13 +352,35 @@ struct image_file *open_image_file(char *file_path) {
 	}
 
 	// reading the header
-	if (_read_header(stream, &version, &width, &height, &scale) != 0) {
+	struct image_file *result = open_image_stream(stream);
+	if (result == NULL) {
 		fclose(stream);
 		return NULL; // failed reading header
 	}
 
+	printf("<netpbm>: opened an image of format \"P%d\".\n", result->version);
+
+	// return the structure
+	return result;
+}
+
+/*
+ * Reads the header of the next image from an already opened stream, which
+ * may be a pipe. The stream is left positioned at the start of the image body
+ * and is not closed by any of the frame functions.
+ *
+ * Returns NULL if error occurred, otherwise a pointer to the image_file
+ * structure is returned.
+ */
+struct image_file *open_image_stream(FILE *stream) {
+	// defining variables we'll need
+	u_int32_t width, height, scale;
+	int version;
+
+	// reading the header
+	if (_read_header(stream, &version, &width, &height, &scale) != 0) return NULL;
+
 	// fill the struct with the acquired data and send it back in
-	printf("<netpbm>: opened an image of format \"P%d\".\n", version);
 	struct image_file *result = (struct image_file *) malloc(sizeof(struct image_file));
 	*result = (struct image_file) {.width = width,
 		.height = height,
@@ -236,7 +388,157 @@ struct image_file *open_image_file(char *file_path) {
 		.stream = stream,
 		.version = version};
 
-	// return the structure
+	return result;
+}
+
+/*
+ * Maps a binary P5 or P6 image file into memory after reading its header.
+ * Nothing but the header is read at this point, the pages of the file are
+ * loaded by the system only for the rows that are actually accessed, which
+ * is what the region functions rely on for huge images. Only 8-bit images
+ * are supported.
+ *
+ * Returns NULL if error occurred, otherwise a pointer to the mapped_image structure.
+ */
+struct mapped_image *open_mapped_image(char *file_path) {
+	struct image_file *file = open_image_file(file_path);
+	if (file == NULL) return NULL;
+
+	struct mapped_image *image = (struct mapped_image *) malloc(sizeof(struct mapped_image));
+	*image = (struct mapped_image) {.version = file->version,
+		.width = file->width,
+		.height = file->height,
+		.scale = file->scale,
+		.channels = file->version == NETPBM_RGB_BINARY ? 3 : 1};
+
+	long offset = ftell(file->stream);
+	struct stat file_stat;
+	int failed = 0;
+
+	if (image->version != NETPBM_GRAYSCALE_BINARY && image->version != NETPBM_RGB_BINARY) {
+		printf("<netpbm>: only P5 and P6 images can be mapped into memory.\n");
+		failed = 1;
+	} else if (image->scale > 255) {
+		printf("<netpbm>: only 8-bit images can be mapped into memory.\n");
+		failed = 1;
+	} else if (fstat(fileno(file->stream), &file_stat) != 0
+	           || (u_int64_t) file_stat.st_size < offset + (u_int64_t) image->width * image->height * image->channels) {
+		printf("<netpbm>: the image file is shorter than its header says.\n");
+		failed = 1;
+	} else {
+		image->size = file_stat.st_size;
+		image->data = (u_int8_t *) mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fileno(file->stream), 0);
+		if (image->data == MAP_FAILED) {
+			printf("<netpbm>: could not map the image file.\n");
+			failed = 1;
+		}
+	}
+
+	// the mapping stays valid after the file is closed
+	fclose(file->stream);
+	free(file);
+
+	if (failed) {
+		free(image);
+		return NULL;
+	}
+
+	// rows are going to be accessed in no particular order
+	madvise(image->data, image->size, MADV_RANDOM);
+	image->body = image->data + offset;
+
+	return image;
+}
+
+/*
+ * Reads the columns [x_from, x_to) of a row of the mapped image as grayscale
+ * values, P6 pixels are converted with the given mode. Columns outside of
+ * the image are read as zeros, so the bounds may be negative or past the width.
+ */
+void read_mapped_row(struct mapped_image *image, u_int32_t y, int64_t x_from, int64_t x_to, u_int32_t *result, int mode) {
+	// the part that is inside of the image
+	int64_t from = x_from > 0 ? x_from : 0;
+	int64_t to = x_to < image->width ? x_to : image->width;
+
+	for (int64_t x = x_from; x < from && x < x_to; x++) result[x - x_from] = 0;
+	for (int64_t x = to > x_from ? to : x_from; x < x_to; x++) result[x - x_from] = 0;
+	if (from >= to) return;
+
+	u_int8_t *bytes = image->body + ((u_int64_t) y * image->width + from) * image->channels;
+	if (image->channels == 1) {
+		kernel_unpack_samples(bytes, result + (from - x_from), to - from);
+		return;
+	}
+
+	// widen the pixels to convert them with the usual kernel
+	struct rgb_color *row = (struct rgb_color *) malloc((to - from) * sizeof(struct rgb_color));
+	kernel_unpack_samples(bytes, (u_int32_t *) row, 3 * (to - from));
+	kernel_rgb_to_grayscale(row, result + (from - x_from), to - from, image->scale, mode);
+	free(row);
+}
+
+/*
+ * Unmaps the image file and frees the structure
+ */
+void free_mapped_image(struct mapped_image *image) {
+	munmap(image->data, image->size);
+	free(image);
+}
+
+/*
+ * Skips the whitespace between two images of a multi-image stream, Netpbm
+ * allows any number of images to be concatenated this way.
+ *
+ * Returns EOF if there are no more images in the stream, otherwise returns 0.
+ */
+int skip_to_next_frame(FILE *stream) {
+	int c;
+	while ((c = fgetc(stream)) == ' ' || c == '\n' || c == '\r' || c == '\t');
+	if (c == EOF) return EOF;
+
+	ungetc(c, stream);
+	return 0;
+}
+
+/*
+ * Reads the next image of a stream as grayscale: P2 and P5 images are taken
+ * as they are, P3 and P6 images are converted with the given mode while parsing.
+ *
+ * Returns NULL in case of an error or a pointer to struct grayscale_image.
+ */
+struct grayscale_image *read_grayscale_frame(FILE *stream, int mode) {
+	struct image_file *image = open_image_stream(stream);
+	if (image == NULL) return NULL;
+
+	struct grayscale_image *result = create_grayscale_image(image->width, image->height, image->scale);
+
+	// parsing the image according to the specified type
+	int parse_result;
+	switch (image->version) {
+		case NETPBM_GRAYSCALE_ASCII:
+			parse_result = _parse_grayscale_body_ascii(stream, result);
+			break;
+		case NETPBM_GRAYSCALE_BINARY:
+			parse_result = _parse_grayscale_body_binary(stream, result);
+			break;
+		case NETPBM_RGB_ASCII:
+			parse_result = _parse_rgb_body_ascii_as_grayscale(stream, result, mode);
+			break;
+		case NETPBM_RGB_BINARY:
+			parse_result = _parse_rgb_body_binary_as_grayscale(stream, result, mode);
+			break;
+		default:
+			printf("<netpbm>: incorrect version of the image.\n");
+			parse_result = -1;
+	}
+
+	free(image);
+
+	if (parse_result != 0) {
+		free_grayscale_image(result);
+		return NULL;
+	}
+
 	return result;
 }
 
@@ -293,57 +595,291 @@ struct rgb_image *open_rgb_image(char *file_path) {
  * Returns -1 if error occurred, otherwise returns 0.
  */
 static int _parse_rgb_body_ascii(FILE *stream, struct rgb_image *image) {
-	// handy struct for the parsed pixels
-	struct rgb_color pixel;
+	struct ascii_reader reader;
+	_open_ascii_reader(&reader, stream);
+
+	// the channels of a pixel are consecutive samples
+	int result = 0;
+	for (int y = 0; y < image->height && result == 0; y++) {
+		result = _read_ascii_samples(&reader, (u_int32_t *) image->matrix[y], image->width * 3);
+	}
+
+	_close_ascii_reader(&reader);
+
+	if (result != 0) printf("<netpbm>: ASCII parsing error, incorrect format.\n");
+
+	return result;
+}
+
+/*
+ * Reading RGB pixels represented as bytes from the image file.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+static int _parse_rgb_body_binary(FILE *stream, struct rgb_image *image) {
+	// this time chars will do, a row at a time
+	u_int8_t *bytes = (u_int8_t *) malloc(image->width * 3 * sizeof(u_int8_t));
 
 	// parsing width * height pixels
-	int items_read;
 	for (int y = 0; y < image->height; y++) {
-		for (int x = 0; x < image->width; x++) {
-			items_read = fscanf(stream, "%u %u %u", &pixel.r, &pixel.g, &pixel.b);
-			if (items_read < 3) {
-				printf("<netpbm>: ASCII parsing error, incorrect format.\n");
-				return -1;
-			}
-
-			// assign the color
-			image->matrix[y][x] = (struct rgb_color) {.r = pixel.r, .g = pixel.g, .b = pixel.b};
+		if (fread(bytes, sizeof(u_int8_t), image->width * 3, stream) < image->width * 3) {
+			printf("<netpbm>: binary parsing error, incorrect format.\n");
+			free(bytes);
+			return -1;
 		}
+
+		// the channels of a pixel are consecutive samples
+		kernel_unpack_samples(bytes, (u_int32_t *) image->matrix[y], image->width * 3);
 	}
 
+	free(bytes);
+
 	return 0;
 }
 
 /*
- * Reading RGB pixels represented as bytes from the image file.
+ * Same as open_rgb_image, but converts every pixel to grayscale (using the given
+ * mode) while parsing the P3 or P6 body, so the RGB matrix is never allocated. Only one
+ * row of RGB pixels is kept in memory at a time, which brings the peak memory
+ * down from 16 bytes per pixel (RGB + grayscale) to 4.
+ *
+ * Returns NULL in case of an error or a pointer to struct grayscale_image.
+ */
+struct grayscale_image *open_rgb_image_as_grayscale(char *file_path, int mode) {
+	printf("<netpbm>: opening the image at \"%s\".\n", file_path);
+
+	// opening the file and reading the header
+	struct image_file *image = open_image_file(file_path);
+	if (image == NULL) return NULL;
+
+	if (image->version != NETPBM_RGB_ASCII && image->version != NETPBM_RGB_BINARY) {
+		printf("<netpbm>: incorrect version of the image.\n");
+		fclose(image->stream);
+		free(image);
+		return NULL;
+	}
+
+	// the resulting image is going to be stored here
+	struct grayscale_image *result = create_grayscale_image(image->width, image->height, image->scale);
+
+	printf("<netpbm>: parsing the image...\n");
+
+	// parsing the image according to the specified type
+	int parse_result;
+	if (image->version == NETPBM_RGB_ASCII) parse_result = _parse_rgb_body_ascii_as_grayscale(image->stream, result, mode);
+	else parse_result = _parse_rgb_body_binary_as_grayscale(image->stream, result, mode);
+
+	fclose(image->stream);
+	free(image);
+
+	if (parse_result != 0) {
+		free_grayscale_image(result);
+		return NULL;
+	}
+
+	printf("<netpbm>: successfully parsed the image.\n");
+
+	return result;
+}
+
+/*
+ * Reading RGB pixels represented as ASCII text from the image file
+ * and converting them to grayscale row by row.
  *
  * Returns -1 if error occurred, otherwise returns 0.
  */
-static int _parse_rgb_body_binary(FILE *stream, struct rgb_image *image) {
-	// this time chars will do
-	u_int8_t rgb[3];
+static int _parse_rgb_body_ascii_as_grayscale(FILE *stream, struct grayscale_image *image, int mode) {
+	// a single row of parsed pixels, reused for every row of the image
+	struct rgb_color *row = (struct rgb_color *) malloc(image->width * sizeof(struct rgb_color));
+
+	struct ascii_reader reader;
+	_open_ascii_reader(&reader, stream);
 
 	// parsing width * height pixels
-	int items_read;
 	for (int y = 0; y < image->height; y++) {
-		for (int x = 0; x < image->width; x++) {
-			items_read = fread(rgb, sizeof(u_int8_t), 3, stream);
-			if (items_read < 3) {
-				printf("<netpbm>: binary parsing error, incorrect format.\n");
-				return -1;
-			}
+		if (_read_ascii_samples(&reader, (u_int32_t *) row, image->width * 3) != 0) {
+			printf("<netpbm>: ASCII parsing error, incorrect format.\n");
+			_close_ascii_reader(&reader);
+			free(row);
+			return -1;
+		}
 
-			// assign the color
-			image->matrix[y][x] = (struct rgb_color) {
-				.r = (u_int32_t) rgb[0],
-				.g = (u_int32_t) rgb[1],
-				.b = (u_int32_t) rgb[2]};
+		kernel_rgb_to_grayscale(row, image->matrix[y], image->width, image->scale, mode);
+	}
+
+	_close_ascii_reader(&reader);
+	free(row);
+
+	return 0;
+}
+
+/*
+ * Reading RGB pixels represented as bytes from the image file
+ * and converting them to grayscale row by row.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+static int _parse_rgb_body_binary_as_grayscale(FILE *stream, struct grayscale_image *image, int mode) {
+	// raw bytes of a single row and the same row widened to rgb_color
+	u_int8_t *bytes = (u_int8_t *) malloc(image->width * 3 * sizeof(u_int8_t));
+	struct rgb_color *row = (struct rgb_color *) malloc(image->width * sizeof(struct rgb_color));
+
+	// parsing the image one row at a time
+	for (int y = 0; y < image->height; y++) {
+		if (fread(bytes, sizeof(u_int8_t), image->width * 3, stream) < image->width * 3) {
+			printf("<netpbm>: binary parsing error, incorrect format.\n");
+			free(bytes);
+			free(row);
+			return -1;
 		}
+
+		kernel_unpack_samples(bytes, (u_int32_t *) row, image->width * 3);
+		kernel_rgb_to_grayscale(row, image->matrix[y], image->width, image->scale, mode);
 	}
 
+	free(bytes);
+	free(row);
+
 	return 0;
 }
 
+/*
+ * Opens an image of any grayscale or RGB format (P2, P3, P5 or P6) as grayscale,
+ * converting RGB pixels with the given mode. With a factor greater than 1, the
+ * image is reduced while it is decoded: every factor x factor block becomes
+ * one pixel holding the average of the block, so only the reduced image is
+ * ever allocated.
+ *
+ * Returns NULL in case of an error or a pointer to struct grayscale_image.
+ */
+struct grayscale_image *open_image_as_grayscale(char *file_path, int mode, u_int32_t factor) {
+	printf("<netpbm>: opening the image at \"%s\".\n", file_path);
+
+	FILE *stream = fopen(file_path, "r");
+	if (stream == NULL) {
+		printf("<netpbm>: could not open image file.\n");
+		return NULL;
+	}
+
+	struct grayscale_image *result = factor > 1 ? read_downscaled_frame(stream, mode, factor) : read_grayscale_frame(stream, mode);
+	fclose(stream);
+
+	if (result != NULL) printf("<netpbm>: successfully parsed the image.\n");
+
+	return result;
+}
+
+/*
+ * Reads the next image of a stream as grayscale, reducing it by the given
+ * factor on the way. The rows are decoded one at a time and summed up in
+ * blocks, the blocks at the right and bottom borders may be smaller.
+ *
+ * Returns NULL in case of an error or a pointer to struct grayscale_image.
+ */
+struct grayscale_image *read_downscaled_frame(FILE *stream, int mode, u_int32_t factor) {
+	if (factor < 1 || factor > DOWNSCALE_MAX_FACTOR) {
+		printf("<netpbm>: the factor must be between 1 and %d.\n", DOWNSCALE_MAX_FACTOR);
+		return NULL;
+	}
+
+	struct image_file *image = open_image_stream(stream);
+	if (image == NULL) return NULL;
+
+	if (image->version != NETPBM_GRAYSCALE_ASCII && image->version != NETPBM_GRAYSCALE_BINARY
+	    && image->version != NETPBM_RGB_ASCII && image->version != NETPBM_RGB_BINARY) {
+		printf("<netpbm>: incorrect version of the image.\n");
+		free(image);
+		return NULL;
+	}
+
+	u_int32_t width = (image->width + factor - 1) / factor;
+	u_int32_t height = (image->height + factor - 1) / factor;
+	struct grayscale_image *result = create_grayscale_image(width, height, image->scale);
+
+	// one decoded row, the raw bytes or pixels it is decoded from, and the sums of the blocks
+	u_int32_t *row = (u_int32_t *) malloc(image->width * sizeof(u_int32_t));
+	u_int8_t *bytes = (u_int8_t *) malloc(image->width * 3 * sizeof(u_int8_t));
+	struct rgb_color *pixels = (struct rgb_color *) malloc(image->width * sizeof(struct rgb_color));
+	u_int32_t *sums = (u_int32_t *) malloc(width * sizeof(u_int32_t));
+
+	struct ascii_reader reader;
+	_open_ascii_reader(&reader, stream);
+
+	int parse_result = 0;
+	for (u_int32_t y = 0; y < height && parse_result == 0; y++) {
+		memset(sums, 0, width * sizeof(u_int32_t));
+
+		u_int32_t rows = (y + 1) * factor <= image->height ? factor : image->height - y * factor;
+		for (u_int32_t r = 0; r < rows && parse_result == 0; r++) {
+			parse_result = _read_grayscale_row(stream, &reader, image, mode, row, bytes, pixels);
+
+			for (u_int32_t x = 0; x < width; x++) {
+				u_int32_t to = (x + 1) * factor <= image->width ? (x + 1) * factor : image->width;
+				for (u_int32_t i = x * factor; i < to; i++) sums[x] += row[i];
+			}
+		}
+
+		// the rounded average of every block
+		for (u_int32_t x = 0; x < width; x++) {
+			u_int32_t columns = (x + 1) * factor <= image->width ? factor : image->width - x * factor;
+			u_int32_t count = rows * columns;
+			result->matrix[y][x] = (sums[x] + count / 2) / count;
+		}
+	}
+
+	_close_ascii_reader(&reader);
+	free(row);
+	free(bytes);
+	free(pixels);
+	free(sums);
+	free(image);
+
+	if (parse_result != 0) {
+		free_grayscale_image(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+/*
+ * Reads one row of a P2, P3, P5 or P6 image body as grayscale values. The
+ * bytes and the pixels must have room for a row of RGB bytes and of rgb_color.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+static int _read_grayscale_row(FILE *stream, struct ascii_reader *reader, struct image_file *image, int mode,
+                               u_int32_t *result, u_int8_t *bytes, struct rgb_color *pixels) {
+
+	switch (image->version) {
+		case NETPBM_GRAYSCALE_ASCII:
+			if (_read_ascii_samples(reader, result, image->width) != 0) {
+				printf("<netpbm>: ASCII parsing error, incorrect format.\n");
+				return -1;
+			}
+			return 0;
+		case NETPBM_RGB_ASCII:
+			if (_read_ascii_samples(reader, (u_int32_t *) pixels, image->width * 3) != 0) {
+				printf("<netpbm>: ASCII parsing error, incorrect format.\n");
+				return -1;
+			}
+			kernel_rgb_to_grayscale(pixels, result, image->width, image->scale, mode);
+			return 0;
+		case NETPBM_GRAYSCALE_BINARY:
+			if (fread(bytes, sizeof(u_int8_t), image->width, stream) < image->width) break;
+			kernel_unpack_samples(bytes, result, image->width);
+			return 0;
+		default:
+			if (fread(bytes, sizeof(u_int8_t), image->width * 3, stream) < image->width * 3) break;
+			kernel_unpack_samples(bytes, (u_int32_t *) pixels, image->width * 3);
+			kernel_rgb_to_grayscale(pixels, result, image->width, image->scale, mode);
+			return 0;
+	}
+
+	printf("<netpbm>: binary parsing error, incorrect format.\n");
+	return -1;
+}
+
 /*
  * Tries to open the file that contains the image,
  * then reads the header, which should consist of the image type (we expect P2 or P5),
@@ -398,25 +934,20 @@ struct grayscale_image *open_grayscale_image(char *file_path) {
  * Returns -1 if error occurred, otherwise returns 0.
  */
 static int _parse_grayscale_body_ascii(FILE *stream, struct grayscale_image *image) {
-	// an unsigned integer for the grayscale value
-	u_int32_t pixel;
-
-	// parsing width * height pixels
-	int items_read;
-	for (int y = 0; y < image->height; y++) {
-		for (int x = 0; x < image->width; x++) {
-			items_read = fscanf(stream, "%u", &pixel);
-			if (items_read < 1) {
-				printf("<netpbm>: ASCII parsing error, incorrect format.\n");
-				return -1;
-			}
+	struct ascii_reader reader;
+	_open_ascii_reader(&reader, stream);
 
-			// assign the color
-			image->matrix[y][x] = pixel;
-		}
+	// parsing width * height pixels, a row at a time
+	int result = 0;
+	for (int y = 0; y < image->height && result == 0; y++) {
+		result = _read_ascii_samples(&reader, image->matrix[y], image->width);
 	}
 
-	return 0;
+	_close_ascii_reader(&reader);
+
+	if (result != 0) printf("<netpbm>: ASCII parsing error, incorrect format.\n");
+
+	return result;
 }
 
 /*
@@ -425,24 +956,22 @@ static int _parse_grayscale_body_ascii(FILE *stream, struct grayscale_image *ima
  * Returns -1 if error occurred, otherwise returns 0.
  */
 static int _parse_grayscale_body_binary(FILE *stream, struct grayscale_image *image) {
-	// an unsigned integer for the grayscale value
-	u_int8_t pixel;
+	// the bytes of a single row
+	u_int8_t *bytes = (u_int8_t *) malloc(image->width * sizeof(u_int8_t));
 
 	// parsing width * height pixels
-	int items_read;
 	for (int y = 0; y < image->height; y++) {
-		for (int x = 0; x < image->width; x++) {
-			items_read = fread(&pixel, sizeof(u_int8_t), 1, stream);
-			if (items_read < 1) {
-				printf("<netpbm>: binary parsing error, incorrect format.\n");
-				return -1;
-			}
-
-			// assign the color
-			image->matrix[y][x] = pixel;
+		if (fread(bytes, sizeof(u_int8_t), image->width, stream) < image->width) {
+			printf("<netpbm>: binary parsing error, incorrect format.\n");
+			free(bytes);
+			return -1;
 		}
+
+		kernel_unpack_samples(bytes, image->matrix[y], image->width);
 	}
 
+	free(bytes);
+
 	return 0;
 }
 
@@ -525,28 +1054,29 @@ static int _parse_blackwhite_body_ascii(FILE *stream, struct blackwhite_image *i
 }
 
 /*
- * Reading black and white image pixels represented as bytes from the image file.
+ * Reading black and white image pixels represented as bits from the image file.
  *
  * Returns -1 if error occurred, otherwise returns 0.
  */
 static int _parse_blackwhite_body_binary(FILE *stream, struct blackwhite_image *image) {
-	// an unsigned integer for the grayscale value
-	u_int8_t pixel;
+	// every row is packed 8 pixels per byte, starting from the high bit
+	u_int32_t packed_width = (image->width + 7) / 8;
+	u_int8_t *packed = (u_int8_t *) malloc(packed_width);
 
-	// parsing width * height pixels
-	int items_read;
 	for (int y = 0; y < image->height; y++) {
-		for (int x = 0; x < image->width; x++) {
-			items_read = fread(&pixel, sizeof(u_int8_t), 1, stream);
-			if (items_read < 1) {
-				printf("<netpbm>: binary parsing error, incorrect format.\n");
-				return -1;
-			}
+		if (fread(packed, sizeof(u_int8_t), packed_width, stream) < packed_width) {
+			printf("<netpbm>: binary parsing error, incorrect format.\n");
+			free(packed);
+			return -1;
+		}
 
-			image->matrix[y][x] = pixel;
+		for (u_int32_t x = 0; x < image->width; x++) {
+			image->matrix[y][x] = (packed[x / 8] >> (7 - x % 8)) & 1;
 		}
 	}
 
+	free(packed);
+
 	return 0;
 }
 
@@ -616,28 +1146,52 @@ int write_grayscale_image(char *file_path, struct grayscale_image *image, int fo
 		return -1;
 	}
 
+	write_grayscale_frame(stream, image, format);
+
+	int version = format == NETPBM_ASCII ? NETPBM_GRAYSCALE_ASCII : NETPBM_GRAYSCALE_BINARY;
+	printf("<netpbm>: image written in P%d grayscale format in \"%s\"\n", version, file_path);
+
+	fclose(stream);
+
+	return 0;
+}
+
+/*
+ * Writes the grayscale image, header and body, to an already opened stream.
+ * Binary rows are packed into bytes first and written at once.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int write_grayscale_frame(FILE *stream, struct grayscale_image *image, int format) {
+	if (format != NETPBM_ASCII && format != NETPBM_BINARY) {
+		printf("<netpbm>: could not write, incorrect format specified.\n");
+		return -1;
+	}
+
 	// write the header to file
 	int version = format == NETPBM_ASCII ? NETPBM_GRAYSCALE_ASCII : NETPBM_GRAYSCALE_BINARY;
 	fprintf(stream, "P%d\n%u %u\n%u\n", version, image->width, image->height, image->scale);
 
+	u_int8_t *bytes = format == NETPBM_BINARY ? (u_int8_t *) malloc(image->width * sizeof(u_int8_t)) : NULL;
+
 	// write all pixels down line by line
 	for (int y = 0; y < image->height; y++) {
-		for (int x = 0; x < image->width; x++) {
-			if (format == NETPBM_ASCII) fprintf(stream, "%u ", image->matrix[y][x]);
-			else fwrite(&image->matrix[y][x], sizeof(u_int8_t), 1, stream);
+		if (format == NETPBM_ASCII) {
+			for (int x = 0; x < image->width; x++) fprintf(stream, "%u ", image->matrix[y][x]);
+			fprintf(stream, "\n");
+		} else {
+			kernel_pack_samples(image->matrix[y], bytes, image->width);
+			fwrite(bytes, sizeof(u_int8_t), image->width, stream);
 		}
-		if (format == NETPBM_ASCII) fprintf(stream, "\n");
 	}
 
-	printf("<netpbm>: image written in P%d grayscale format in \"%s\"\n", version, file_path);
-
-	fclose(stream);
+	free(bytes);
 
-	return 0;
+	return ferror(stream) ? -1 : 0;
 }
 
 /*
- * Uses existing blackwhite_image structure to save it to disk in the P1
+ * Uses existing blackwhite_image structure to save it to disk in the P1 or P4
  * black and white format
  *
  * Returns -1 if could not open file, otherwise returns 0.
@@ -661,14 +1215,23 @@ int write_blackwhite_image(char *file_path, struct blackwhite_image *image, int
 	int version = format == NETPBM_ASCII ? NETPBM_BLACKWHITE_ASCII : NETPBM_BLACKWHITE_BINARY;
 	fprintf(stream, "P%d\n%u %u\n", version, image->width, image->height);
 
-	// write all pixels down line by line
+	// write all pixels down line by line, P4 packs 8 pixels into a byte starting from the high bit
+	u_int32_t packed_width = (image->width + 7) / 8;
+	u_int8_t *packed = (u_int8_t *) malloc(packed_width);
 	for (int y = 0; y < image->height; y++) {
-		for (int x = 0; x < image->width; x++) {
-			if (format == NETPBM_ASCII) fprintf(stream, "%hhu ", image->matrix[y][x]);
-			else fwrite(&image->matrix[y][x], sizeof(u_int8_t), 1, stream);
+		if (format == NETPBM_ASCII) {
+			for (int x = 0; x < image->width; x++) fprintf(stream, "%hhu ", image->matrix[y][x]);
+			fprintf(stream, "\n");
+			continue;
 		}
-		if (format == NETPBM_ASCII) fprintf(stream, "\n");
+
+		memset(packed, 0, packed_width);
+		for (u_int32_t x = 0; x < image->width; x++) {
+			if (image->matrix[y][x]) packed[x / 8] |= 0x80 >> (x % 8);
+		}
+		fwrite(packed, sizeof(u_int8_t), packed_width, stream);
 	}
+	free(packed);
 
 	printf("<netpbm>: image written in P%d black and white format in \"%s\"\n", version, file_path);
 
@@ -676,3 +1239,72 @@ int write_blackwhite_image(char *file_path, struct blackwhite_image *image, int
 
 	return 0;
 }
+
+/*
+ * Prepares to read the samples of the ASCII body that starts
+ * at the current position of the stream.
+ */
+static void _open_ascii_reader(struct ascii_reader *reader, FILE *stream) {
+	*reader = (struct ascii_reader) {.stream = stream};
+	reader->seekable = ftell(stream) >= 0 && fseek(stream, 0, SEEK_CUR) == 0;
+	if (!reader->seekable) return;
+
+	reader->capacity = ASCII_READER_CHUNK;
+	reader->buffer = (char *) malloc(reader->capacity);
+}
+
+/*
+ * Reads the next count samples of the body. The text is tokenized up to the
+ * last whitespace that has been read, so that no number is cut in two; when
+ * that is not enough, more text is read, into a larger buffer if it is full.
+ *
+ * Returns -1 if the text is incorrect or too short, otherwise returns 0.
+ */
+static int _read_ascii_samples(struct ascii_reader *reader, u_int32_t *values, u_int32_t count) {
+	if (!reader->seekable) {
+		for (u_int32_t i = 0; i < count; i++) {
+			if (fscanf(reader->stream, "%u", &values[i]) < 1) return -1;
+		}
+		return 0;
+	}
+
+	while (1) {
+		char *text = reader->buffer + reader->start;
+		char *end = reader->buffer + reader->length;
+		if (!reader->ended) {
+			while (end > text && end[-1] != ' ' && end[-1] != '\n' && end[-1] != '\r' && end[-1] != '\t') end--;
+		}
+
+		char *next = end > text || count == 0 ? kernel_parse_ascii(text, end, values, count) : NULL;
+		if (next != NULL) {
+			reader->start = next - reader->buffer;
+			return 0;
+		}
+		if (reader->ended) return -1;
+
+		// keep the text that is not parsed yet and read more after it
+		reader->length -= reader->start;
+		memmove(reader->buffer, reader->buffer + reader->start, reader->length);
+		reader->start = 0;
+		if (reader->length == reader->capacity) {
+			reader->capacity *= 2;
+			reader->buffer = (char *) realloc(reader->buffer, reader->capacity);
+		}
+
+		size_t wanted = reader->capacity - reader->length;
+		size_t read = fread(reader->buffer + reader->length, 1, wanted, reader->stream);
+		reader->length += read;
+		if (read < wanted) reader->ended = 1;
+	}
+}
+
+/*
+ * Gives the text read past the last sample back to the stream,
+ * so that whatever follows the body is read from the right place.
+ */
+static void _close_ascii_reader(struct ascii_reader *reader) {
+	if (!reader->seekable) return;
+
+	fseek(reader->stream, -(long) (reader->length - reader->start), SEEK_CUR);
+	free(reader->buffer);
+}
@@ -17,6 +17,17 @@
 #define NETPBM_ASCII 1
 #define NETPBM_BINARY 2
 
+#define DOWNSCALE_MAX_FACTOR 64
+
+/*
+ * How many bytes of an ASCII body are read at a time to be tokenized
+ */
+#define ASCII_READER_CHUNK (64 << 10)
+
+#define GRAYSCALE_AVERAGE 0
+#define GRAYSCALE_BT601 1
+#define GRAYSCALE_BT709 2
+
 /* TYPES */
 
 /* STRUCTURES */
@@ -51,6 +62,32 @@ struct grayscale_image {
     u_int32_t **matrix; // same as rgb, but no need for third level array, just a number
 };
 
+/*
+ * A pyramid of grayscale images, each level is half the size of the previous
+ * one (rounded up), level 0 being the original size. The pixels and the row
+ * pointers of all the levels live in single allocations.
+ */
+struct grayscale_pyramid {
+    u_int32_t count;
+    struct grayscale_image *levels;
+    u_int32_t *pixels;
+    u_int32_t **rows;
+};
+
+/*
+ * Reads the samples of an ASCII body a chunk at a time, so that they are
+ * tokenized by kernel_parse_ascii instead of one fscanf per sample. The text
+ * between start and length has been read but not parsed yet and is given back
+ * to the stream when the body ends. Streams that cannot seek back, such as
+ * pipes, are read with fscanf.
+ */
+struct ascii_reader {
+    FILE *stream;
+    char *buffer;
+    size_t start, length, capacity;
+    int seekable, ended;
+};
+
 /*
  * Contains data about a black and white image in a 2D matrix, where an element
  * of the matrix is a 1 or a 0
@@ -61,6 +98,31 @@ struct blackwhite_image {
     u_int8_t **matrix; // it is just 0 or 1, so one byte is enough
 };
 
+/*
+ * A binary (P5 or P6) image file mapped into memory, the pixels are
+ * only read from the disk when a row is accessed.
+ */
+struct mapped_image {
+    int version;
+    u_int32_t width;
+    u_int32_t height;
+    u_int32_t scale;
+    u_int32_t channels; // 1 for P5, 3 for P6
+    u_int8_t *data; // the whole mapped file
+    size_t size;
+    u_int8_t *body; // first byte of the pixels
+};
+
+/*
+ * Contains the data shared by the threads converting
+ * an RGB image to grayscale.
+ */
+struct grayscale_conversion_task {
+    struct rgb_image *source_image;
+    struct grayscale_image *destination_image;
+    int mode;
+};
+
 /*
  * A helper structure for File IO
  */
@@ -78,16 +140,34 @@ struct image_file {
 struct rgb_image *create_rgb_image(u_int32_t width, u_int32_t height, u_int32_t scale);
 struct grayscale_image *create_grayscale_image(u_int32_t width, u_int32_t height, u_int32_t scale);
 struct blackwhite_image *create_blackwhite_image(u_int32_t width, u_int32_t height);
+struct grayscale_image *copy_grayscale_image(struct grayscale_image *image);
+struct grayscale_pyramid *create_grayscale_pyramid(u_int32_t width, u_int32_t height, u_int32_t scale, u_int32_t count);
 
 /* Image processing */
 struct grayscale_image *rgb_to_grayscale_image(struct rgb_image *image);
+struct grayscale_image *convert_rgb_to_grayscale(struct rgb_image *image, int mode, int threads);
+static void *_convert_rgb_to_grayscale_thread_job(void *data);
 
 /* File IO */
 struct rgb_image *open_rgb_image(char *file_path);
+struct grayscale_image *open_rgb_image_as_grayscale(char *file_path, int mode);
+struct grayscale_image *open_image_as_grayscale(char *file_path, int mode, u_int32_t factor);
 struct grayscale_image *open_grayscale_image(char *file_path);
 struct blackwhite_image *open_blackwhite_image(char *file_path);
 
 struct image_file *open_image_file(char *file_path);
+struct image_file *open_image_stream(FILE *stream);
+
+/* Memory-mapped images */
+struct mapped_image *open_mapped_image(char *file_path);
+void read_mapped_row(struct mapped_image *image, u_int32_t y, int64_t x_from, int64_t x_to, u_int32_t *result, int mode);
+void free_mapped_image(struct mapped_image *image);
+
+/* Multi-image streams */
+int skip_to_next_frame(FILE *stream);
+struct grayscale_image *read_grayscale_frame(FILE *stream, int mode);
+struct grayscale_image *read_downscaled_frame(FILE *stream, int mode, u_int32_t factor);
+int write_grayscale_frame(FILE *stream, struct grayscale_image *image, int format);
 
 int write_rgb_image(char *file_path, struct rgb_image *image, int format);
 int write_grayscale_image(char *file_path, struct grayscale_image *image, int format);
@@ -95,20 +175,29 @@ int write_blackwhite_image(char *file_path, struct blackwhite_image *image, int
 
 static int _parse_rgb_body_ascii(FILE *stream, struct rgb_image *image);
 static int _parse_rgb_body_binary(FILE *stream, struct rgb_image *image);
+static int _parse_rgb_body_ascii_as_grayscale(FILE *stream, struct grayscale_image *image, int mode);
+static int _parse_rgb_body_binary_as_grayscale(FILE *stream, struct grayscale_image *image, int mode);
 static int _parse_grayscale_body_ascii(FILE *stream, struct grayscale_image *image);
 static int _parse_grayscale_body_binary(FILE *stream, struct grayscale_image *image);
 static int _parse_blackwhite_body_ascii(FILE *stream, struct blackwhite_image *image);
 static int _parse_blackwhite_body_binary(FILE *stream, struct blackwhite_image *image);
 
+static int _read_grayscale_row(FILE *stream, struct ascii_reader *reader, struct image_file *image, int mode,
+                               u_int32_t *result, u_int8_t *bytes, struct rgb_color *pixels);
+static void _open_ascii_reader(struct ascii_reader *reader, FILE *stream);
+static int _read_ascii_samples(struct ascii_reader *reader, u_int32_t *values, u_int32_t count);
+static void _close_ascii_reader(struct ascii_reader *reader);
 static int _read_header(FILE *stream, int *version, u_int32_t *width, u_int32_t *height, u_int32_t *scale);
 static int _skip_comment(FILE *stream);
 
 /* Miscellaneous */
+int get_grayscale_mode(char *name);
 static int _get_netpbm_version(char *image_version);
 
 /* Releasing memory */
 void free_rgb_image(struct rgb_image *image);
 void free_grayscale_image(struct grayscale_image *image);
 void free_blackwhite_image(struct blackwhite_image *image);
+void free_grayscale_pyramid(struct grayscale_pyramid *pyramid);
 
 #endif // OMP_NETPBM_H
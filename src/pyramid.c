@@ -0,0 +1,162 @@
+#include "pyramid.h"
+#include "kernels.h"
+#include "threads.h"
+
+/*
+ * Builds a pyramid of the given number of levels out of the image: level 0 is
+ * a copy of the image, every next level is the previous one reduced twice with
+ * a 2x2 box (PYRAMID_BOX) or a 5x5 binomial (PYRAMID_GAUSSIAN) filter. Every
+ * level is divided between the given number of threads.
+ *
+ * Returns NULL in case of an error or a pointer to the grayscale_pyramid structure.
+ */
+struct grayscale_pyramid *build_grayscale_pyramid(struct grayscale_image *image, u_int32_t count, int filter, int threads) {
+	if (image == NULL) {
+		printf("<pyramid>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	if (count < 1 || threads < 1) {
+		printf("<pyramid>: number of levels and threads cannot be less than one.\n");
+		return NULL;
+	}
+
+	struct grayscale_pyramid *pyramid = create_grayscale_pyramid(image->width, image->height, image->scale, count);
+	if (pyramid == NULL) {
+		printf("<pyramid>: could not allocate the pyramid.\n");
+		return NULL;
+	}
+
+	if (pyramid->count < count) {
+		printf("<pyramid>: a %ux%u image has only %u levels.\n", image->width, image->height, pyramid->count);
+		free_grayscale_pyramid(pyramid);
+		return NULL;
+	}
+
+	for (u_int32_t y = 0; y < image->height; y++) {
+		memcpy(pyramid->levels[0].matrix[y], image->matrix[y], image->width * sizeof(u_int32_t));
+	}
+
+	// every level depends on the previous one, so the levels go one by one
+	for (u_int32_t i = 1; i < pyramid->count; i++) {
+		struct pyramid_reduce_task task = {
+			.source_image = &pyramid->levels[i - 1],
+			.destination_image = &pyramid->levels[i],
+			.filter = filter};
+		run_row_bands(pyramid->levels[i].height, threads, _reduce_pyramid_level_thread_job, (void *) &task);
+	}
+
+	return pyramid;
+}
+
+/*
+ * A helper function for building the pyramid. Reduces the rows of the
+ * previous level that give the band of rows of the next level.
+ *
+ * Returns NULL.
+ */
+void *_reduce_pyramid_level_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct pyramid_reduce_task *task = (struct pyramid_reduce_task *) band->context;
+	struct grayscale_image *source = task->source_image;
+
+	u_int32_t *scratch = (u_int32_t *) calloc(REDUCE_SCRATCH(source->width), sizeof(u_int32_t));
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		u_int32_t *result = task->destination_image->matrix[y];
+
+		if (task->filter == PYRAMID_GAUSSIAN) {
+			// five rows around 2y, repeating the borders
+			u_int32_t *rows[5];
+			for (int i = 0; i < 5; i++) {
+				int64_t row = (int64_t) 2 * y + i - 2;
+				if (row < 0) row = 0;
+				if (row >= source->height) row = source->height - 1;
+				rows[i] = source->matrix[row];
+			}
+			kernel_reduce_gaussian_row(rows, result, source->width, scratch);
+		} else {
+			u_int32_t second = 2 * y + 1 < source->height ? 2 * y + 1 : 2 * y;
+			kernel_reduce_box_row(source->matrix[2 * y], source->matrix[second], result, source->width);
+		}
+	}
+
+	free(scratch);
+
+	return NULL;
+}
+
+/*
+ * Applies the sobel operator to every level of the pyramid in a single job:
+ * the rows of all the levels are divided between the given number of threads.
+ *
+ * Returns NULL in case of an error or a pointer to the pyramid of sobel images.
+ */
+struct grayscale_pyramid *sobel_filter_pyramid(struct grayscale_pyramid *pyramid, int threads) {
+	if (pyramid == NULL) {
+		printf("<pyramid>: met NULL instead of an existing pyramid.\n");
+		return NULL;
+	}
+
+	struct grayscale_image *base = &pyramid->levels[0];
+	struct grayscale_pyramid *result = create_grayscale_pyramid(base->width, base->height, base->scale, pyramid->count);
+	if (result == NULL) {
+		printf("<pyramid>: could not allocate the pyramid.\n");
+		return NULL;
+	}
+
+	// number the rows of all the levels one after another
+	u_int32_t *offsets = (u_int32_t *) malloc((pyramid->count + 1) * sizeof(u_int32_t));
+	offsets[0] = 0;
+	for (u_int32_t i = 0; i < pyramid->count; i++) offsets[i + 1] = offsets[i] + pyramid->levels[i].height;
+
+	struct pyramid_sobel_task task = {.source = pyramid, .destination = result, .offsets = offsets};
+	if (run_row_bands(offsets[pyramid->count], threads, _sobel_filter_pyramid_thread_job, (void *) &task) != 0) {
+		free_grayscale_pyramid(result);
+		result = NULL;
+	}
+
+	free(offsets);
+
+	return result;
+}
+
+/*
+ * A helper function for the pyramid sobel. Calculates sobel for the band of
+ * rows given in the row_band_task, which may span several levels.
+ *
+ * Returns NULL.
+ */
+void *_sobel_filter_pyramid_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct pyramid_sobel_task *task = (struct pyramid_sobel_task *) band->context;
+
+	int32_t *scratch = (int32_t *) calloc(SOBEL_GRAYSCALE_SCRATCH(task->source->levels[0].width), sizeof(int32_t));
+
+	u_int32_t i = 0;
+	for (u_int32_t g = band->from; g < band->to; g++) {
+		while (g >= task->offsets[i + 1]) i++;
+
+		struct grayscale_image *level = &task->source->levels[i];
+		u_int32_t y = g - task->offsets[i];
+		u_int32_t *above = y > 0 ? level->matrix[y - 1] : NULL;
+		u_int32_t *below = y + 1 < level->height ? level->matrix[y + 1] : NULL;
+		kernel_sobel_grayscale_row(above, level->matrix[y], below, task->destination->levels[i].matrix[y],
+		                           0, level->width, level->width, level->scale, scratch);
+	}
+
+	free(scratch);
+
+	return NULL;
+}
+
+/*
+ * Maps the name of a pyramid filter: "box" or "gaussian".
+ *
+ * Returns -1 if the name is unknown, otherwise returns the filter.
+ */
+int get_pyramid_filter(char *name) {
+	if (strcmp(name, "box") == 0) return PYRAMID_BOX;
+	if (strcmp(name, "gaussian") == 0) return PYRAMID_GAUSSIAN;
+	return -1;
+}
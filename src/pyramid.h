@@ -0,0 +1,50 @@
+#ifndef OMP_PYRAMID_H
+#define OMP_PYRAMID_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* DEFINES */
+
+#define PYRAMID_BOX 1
+#define PYRAMID_GAUSSIAN 2
+
+/*
+ * A side of at most 2^32 - 1 pixels is halved 32 times down to one pixel
+ */
+#define PYRAMID_MAX_LEVELS 33
+
+/* STRUCTURES */
+
+/*
+ * Contains the data shared by the threads reducing one level of a pyramid
+ * into the next one.
+ */
+struct pyramid_reduce_task {
+    struct grayscale_image *source_image, *destination_image;
+    int filter;
+};
+
+/*
+ * Contains the data shared by the threads running the sobel operation on
+ * all the levels of a pyramid. The rows of all the levels are numbered one
+ * after another, level i owns the rows [offsets[i], offsets[i + 1]).
+ */
+struct pyramid_sobel_task {
+    struct grayscale_pyramid *source, *destination;
+    u_int32_t *offsets;
+};
+
+/* FUNCTIONS */
+
+/* Helpers */
+void *_reduce_pyramid_level_thread_job(void *data);
+void *_sobel_filter_pyramid_thread_job(void *data);
+int get_pyramid_filter(char *name);
+
+/* Building */
+struct grayscale_pyramid *build_grayscale_pyramid(struct grayscale_image *image, u_int32_t count, int filter, int threads);
+
+/* Sobel operation */
+struct grayscale_pyramid *sobel_filter_pyramid(struct grayscale_pyramid *pyramid, int threads);
+
+#endif // OMP_PYRAMID_H
@@ -0,0 +1,190 @@
+#include "region.h"
+#include "kernels.h"
+#include "threads.h"
+
+/*
+ * Applies the sobel operator only inside of the given regions of the image.
+ * The result for every region is a separate image of the size of the region,
+ * computed exactly as sobel_filter_grayscale would compute those pixels.
+ * The rows of all the regions are divided between the given number of threads.
+ *
+ * Returns NULL in case of an error or an array of count images.
+ */
+struct grayscale_image **sobel_filter_regions(struct grayscale_image *image, struct sobel_region *regions, u_int32_t count, int threads) {
+	if (image == NULL) {
+		printf("<sobel>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct sobel_region_task task = {
+		.source = (void *) image,
+		.read_row = _read_grayscale_region_row,
+		.width = image->width,
+		.height = image->height,
+		.scale = image->scale,
+		.regions = regions,
+		.count = count};
+
+	return _sobel_filter_regions(&task, threads);
+}
+
+/*
+ * Same as sobel_filter_regions, but reads the pixels straight from a mapped
+ * binary image, converting P6 pixels to grayscale with the given mode. Only the
+ * rows of the regions and the one row above and below each of them are ever
+ * touched, so the cost depends on the size of the regions, not of the image.
+ *
+ * Returns NULL in case of an error or an array of count images.
+ */
+struct grayscale_image **sobel_filter_mapped_regions(struct mapped_image *image, struct sobel_region *regions, u_int32_t count,
+                                                     int mode, int threads) {
+	if (image == NULL) {
+		printf("<sobel>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct sobel_region_task task = {
+		.source = (void *) image,
+		.read_row = _read_mapped_region_row,
+		.width = image->width,
+		.height = image->height,
+		.scale = image->scale,
+		.mode = mode,
+		.regions = regions,
+		.count = count};
+
+	return _sobel_filter_regions(&task, threads);
+}
+
+/*
+ * Checks the regions, allocates the resulting images and runs the threads.
+ *
+ * Returns NULL in case of an error or an array of count images.
+ */
+static struct grayscale_image **_sobel_filter_regions(struct sobel_region_task *task, int threads) {
+	if (threads < 1) {
+		printf("<sobel>: number of threads cannot be less than one.\n");
+		return NULL;
+	}
+
+	for (u_int32_t i = 0; i < task->count; i++) {
+		struct sobel_region region = task->regions[i];
+		if (region.width == 0 || region.height == 0
+		    || (u_int64_t) region.x + region.width > task->width || (u_int64_t) region.y + region.height > task->height) {
+			printf("<sobel>: region %u does not fit into the image.\n", i);
+			return NULL;
+		}
+	}
+
+	// number the rows of all the regions one after another
+	task->offsets = (u_int32_t *) malloc((task->count + 1) * sizeof(u_int32_t));
+	task->offsets[0] = 0;
+	for (u_int32_t i = 0; i < task->count; i++) task->offsets[i + 1] = task->offsets[i] + task->regions[i].height;
+
+	task->results = (struct grayscale_image **) malloc(task->count * sizeof(struct grayscale_image *));
+	for (u_int32_t i = 0; i < task->count; i++) {
+		task->results[i] = create_grayscale_image(task->regions[i].width, task->regions[i].height, task->scale);
+	}
+
+	run_row_bands(task->offsets[task->count], threads, _sobel_filter_regions_thread_job, (void *) task);
+
+	free(task->offsets);
+
+	return task->results;
+}
+
+/*
+ * Reads a part of a row of a grayscale image in memory, zeros outside.
+ */
+static void _read_grayscale_region_row(struct sobel_region_task *task, u_int32_t y, int64_t x_from, int64_t x_to, u_int32_t *result) {
+	struct grayscale_image *image = (struct grayscale_image *) task->source;
+
+	for (int64_t x = x_from; x < x_to; x++) {
+		result[x - x_from] = x >= 0 && x < image->width ? image->matrix[y][x] : 0;
+	}
+}
+
+/*
+ * Reads a part of a row of a mapped image, zeros outside.
+ */
+static void _read_mapped_region_row(struct sobel_region_task *task, u_int32_t y, int64_t x_from, int64_t x_to, u_int32_t *result) {
+	read_mapped_row((struct mapped_image *) task->source, y, x_from, x_to, result, task->mode);
+}
+
+/*
+ * A helper function for the region sobel filter. Goes through the band of
+ * region rows given in the row_band_task. Every region row needs three rows
+ * of the source, one pixel wider on each side; when the next row belongs to
+ * the same region, two of them are reused.
+ *
+ * Returns NULL.
+ */
+void *_sobel_filter_regions_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct sobel_region_task *task = (struct sobel_region_task *) band->context;
+
+	// the widest region decides the size of the buffers
+	u_int32_t widest = 0;
+	for (u_int32_t i = 0; i < task->count; i++) {
+		if (task->regions[i].width > widest) widest = task->regions[i].width;
+	}
+
+	u_int32_t *rows[3];
+	for (int i = 0; i < 3; i++) rows[i] = (u_int32_t *) malloc((widest + 2) * sizeof(u_int32_t));
+	u_int32_t *sobel = (u_int32_t *) malloc((widest + 2) * sizeof(u_int32_t));
+	int32_t *scratch = (int32_t *) calloc(SOBEL_GRAYSCALE_SCRATCH(widest + 2), sizeof(int32_t));
+
+	u_int32_t i = 0;
+	int valid = 0; // whether the buffers hold the window of the previous row
+	u_int32_t loaded = 0; // image row in rows[1]
+	for (u_int32_t g = band->from; g < band->to; g++) {
+		// find the region this row belongs to
+		while (g >= task->offsets[i + 1]) {
+			i++;
+			valid = 0;
+		}
+
+		struct sobel_region region = task->regions[i];
+		u_int32_t y = region.y + (g - task->offsets[i]);
+		int64_t x_from = (int64_t) region.x - 1, x_to = (int64_t) region.x + region.width + 1;
+
+		if (valid && loaded + 1 == y) {
+			// slide the window down by one row
+			u_int32_t *oldest = rows[0];
+			rows[0] = rows[1];
+			rows[1] = rows[2];
+			rows[2] = oldest;
+			if (y + 1 < task->height) task->read_row(task, y + 1, x_from, x_to, rows[2]);
+		} else {
+			if (y > 0) task->read_row(task, y - 1, x_from, x_to, rows[0]);
+			task->read_row(task, y, x_from, x_to, rows[1]);
+			if (y + 1 < task->height) task->read_row(task, y + 1, x_from, x_to, rows[2]);
+		}
+		loaded = y;
+		valid = 1;
+
+		// the window is one pixel wider than the region on each side
+		u_int32_t *above = y > 0 ? rows[0] : NULL;
+		u_int32_t *below = y + 1 < task->height ? rows[2] : NULL;
+		kernel_sobel_grayscale_row(above, rows[1], below, sobel, 1, region.width + 1, region.width + 2, task->scale, scratch);
+
+		memcpy(task->results[i]->matrix[y - region.y], sobel + 1, region.width * sizeof(u_int32_t));
+	}
+
+	for (int r = 0; r < 3; r++) free(rows[r]);
+	free(sobel);
+	free(scratch);
+
+	return NULL;
+}
+
+/*
+ * Parses a region given as "x,y,width,height".
+ *
+ * Returns -1 if the text is incorrect, otherwise returns 0.
+ */
+int parse_sobel_region(char *text, struct sobel_region *region) {
+	char end;
+	if (sscanf(text, "%u,%u,%u,%u%c", &region->x, &region->y, &region->width, &region->height, &end) != 4) return -1;
+	return 0;
+}
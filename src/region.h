@@ -0,0 +1,47 @@
+#ifndef OMP_REGION_H
+#define OMP_REGION_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* STRUCTURES */
+
+/*
+ * A rectangular region of interest of an image, in pixels
+ */
+struct sobel_region {
+    u_int32_t x, y;
+    u_int32_t width, height;
+};
+
+/*
+ * Contains the data shared by the threads computing sobel in regions.
+ * The rows of all the regions are numbered one after another, region i
+ * owns the rows [offsets[i], offsets[i + 1]). The source is either an
+ * image in memory or a mapped image, read_row gets its rows.
+ */
+struct sobel_region_task {
+    void *source;
+    void (*read_row)(struct sobel_region_task *task, u_int32_t y, int64_t x_from, int64_t x_to, u_int32_t *result);
+    u_int32_t width, height, scale;
+    int mode;
+    struct sobel_region *regions;
+    u_int32_t count;
+    u_int32_t *offsets;
+    struct grayscale_image **results;
+};
+
+/* FUNCTIONS */
+
+/* Helpers */
+void *_sobel_filter_regions_thread_job(void *data);
+static void _read_grayscale_region_row(struct sobel_region_task *task, u_int32_t y, int64_t x_from, int64_t x_to, u_int32_t *result);
+static void _read_mapped_region_row(struct sobel_region_task *task, u_int32_t y, int64_t x_from, int64_t x_to, u_int32_t *result);
+static struct grayscale_image **_sobel_filter_regions(struct sobel_region_task *task, int threads);
+int parse_sobel_region(char *text, struct sobel_region *region);
+
+/* Sobel operation */
+struct grayscale_image **sobel_filter_regions(struct grayscale_image *image, struct sobel_region *regions, u_int32_t count, int threads);
+struct grayscale_image **sobel_filter_mapped_regions(struct mapped_image *image, struct sobel_region *regions, u_int32_t count,
+                                                     int mode, int threads);
+
+#endif // OMP_REGION_H
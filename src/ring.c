@@ -0,0 +1,274 @@
+#include "ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Shared memory objects are named with one leading slash.
+ *
+ * Returns the name to be freed.
+ */
+static char *_get_shared_name(char *name) {
+	char *result = (char *) malloc(strlen(name) + 2);
+	sprintf(result, "%s%s", name[0] == '/' ? "" : "/", name);
+	return result;
+}
+
+/*
+ * Points the rows of an image for every slot into the mapped memory.
+ *
+ * Returns a pointer to the frame_ring structure.
+ */
+static struct frame_ring *_map_frame_ring(char *name, struct frame_ring_header *header, size_t size) {
+	struct frame_ring *ring = (struct frame_ring *) malloc(sizeof(struct frame_ring));
+	ring->name = name;
+	ring->header = header;
+	ring->size = size;
+	ring->slots = (struct grayscale_image *) calloc(header->slot_count, sizeof(struct grayscale_image));
+
+	u_int64_t row_size = ((u_int64_t) header->width * sizeof(u_int32_t) + FRAME_RING_ALIGNMENT - 1)
+	                     / FRAME_RING_ALIGNMENT * FRAME_RING_ALIGNMENT;
+	for (u_int32_t i = 0; i < header->slot_count; i++) {
+		u_int8_t *slot = (u_int8_t *) (header + 1) + i * header->slot_size;
+		ring->slots[i] = (struct grayscale_image) {.width = header->width, .height = header->height, .scale = header->scale};
+		ring->slots[i].matrix = (u_int32_t **) malloc(header->height * sizeof(u_int32_t *));
+		for (u_int32_t y = 0; y < header->height; y++) {
+			ring->slots[i].matrix[y] = (u_int32_t *) (slot + FRAME_RING_ALIGNMENT + y * row_size);
+		}
+	}
+
+	return ring;
+}
+
+/*
+ * Creates the shared memory of a ring for frames of the given size, replacing
+ * a ring of the same name that may be left from an earlier run.
+ *
+ * Returns NULL in case of an error or a pointer to the frame_ring structure.
+ */
+struct frame_ring *create_frame_ring(char *name, u_int32_t slot_count, u_int32_t width, u_int32_t height, u_int32_t scale) {
+	if (slot_count < 2) {
+		printf("<ring>: a ring needs at least two slots.\n");
+		return NULL;
+	}
+
+	u_int64_t row_size = ((u_int64_t) width * sizeof(u_int32_t) + FRAME_RING_ALIGNMENT - 1)
+	                     / FRAME_RING_ALIGNMENT * FRAME_RING_ALIGNMENT;
+	u_int64_t slot_size = FRAME_RING_ALIGNMENT + row_size * height;
+	size_t size = sizeof(struct frame_ring_header) + slot_size * slot_count;
+
+	char *shared_name = _get_shared_name(name);
+	shm_unlink(shared_name);
+	int fd = shm_open(shared_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0 || ftruncate(fd, size) != 0) {
+		printf("<ring>: could not create the shared memory \"%s\".\n", shared_name);
+		if (fd >= 0) {
+			close(fd);
+			shm_unlink(shared_name);
+		}
+		free(shared_name);
+		return NULL;
+	}
+
+	struct frame_ring_header *header = (struct frame_ring_header *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		printf("<ring>: could not map the shared memory.\n");
+		shm_unlink(shared_name);
+		free(shared_name);
+		return NULL;
+	}
+
+	// the memory of a new object is zeroed, the magic goes last so that a reader never sees half a header
+	header->format_version = FRAME_RING_FORMAT_VERSION;
+	header->slot_count = slot_count;
+	header->width = width;
+	header->height = height;
+	header->scale = scale;
+	header->slot_size = slot_size;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(header->magic, FRAME_RING_MAGIC, 8);
+
+	printf("<ring>: created \"%s\" with %u slots of %ux%u.\n", shared_name, slot_count, width, height);
+
+	return _map_frame_ring(shared_name, header, size);
+}
+
+/*
+ * Checks that the frames the header describes fit in its slots and the slots
+ * in the mapping, so that no row of a slot points outside of it.
+ *
+ * Returns 1 if the header is correct, otherwise returns 0.
+ */
+static int _check_frame_ring_header(struct frame_ring_header *header, size_t size) {
+	if (header->format_version != FRAME_RING_FORMAT_VERSION || header->slot_count == 0) return 0;
+
+	u_int64_t row_size = ((u_int64_t) header->width * sizeof(u_int32_t) + FRAME_RING_ALIGNMENT - 1)
+	                     / FRAME_RING_ALIGNMENT * FRAME_RING_ALIGNMENT;
+	if (header->height > 0 && row_size > (UINT64_MAX - FRAME_RING_ALIGNMENT) / header->height) return 0;
+	if (header->slot_size < FRAME_RING_ALIGNMENT + row_size * header->height) return 0;
+
+	u_int64_t slots_size = size - sizeof(struct frame_ring_header);
+	return header->slot_size <= slots_size / header->slot_count;
+}
+
+/*
+ * Maps the ring created by another process for reading. The producer may not
+ * have created it yet, so this waits up to FRAME_RING_OPEN_TIMEOUT seconds
+ * for the shared memory to appear with its whole header.
+ *
+ * Returns NULL in case of an error or a pointer to the frame_ring structure.
+ */
+struct frame_ring *open_frame_ring(char *name) {
+	char *shared_name = _get_shared_name(name);
+
+	for (u_int64_t waited = 0;; waited += FRAME_RING_OPEN_POLL_US) {
+		int fd = shm_open(shared_name, O_RDWR, 0);
+		struct stat status;
+		int found = fd >= 0 && fstat(fd, &status) == 0 && status.st_size >= sizeof(struct frame_ring_header);
+
+		struct frame_ring_header *header = MAP_FAILED;
+		size_t size = found ? status.st_size : 0;
+		if (found) header = (struct frame_ring_header *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (fd >= 0) close(fd);
+
+		// the producer writes the magic last, the rest of the header is read after it
+		char magic[8] = {0};
+		if (header != MAP_FAILED) memcpy(magic, header->magic, 8);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (header != MAP_FAILED && memcmp(magic, FRAME_RING_MAGIC, 8) == 0) {
+			if (_check_frame_ring_header(header, size)) return _map_frame_ring(shared_name, header, size);
+
+			printf("<ring>: \"%s\" is not a correct frame ring.\n", shared_name);
+			munmap(header, size);
+			free(shared_name);
+			return NULL;
+		}
+
+		if (header != MAP_FAILED) munmap(header, size);
+
+		// the object is missing, not yet sized or its magic is still being written
+		int pending = fd < 0 ? errno == ENOENT : 1;
+		for (int i = 0; found && pending && i < 8; i++) pending = magic[i] == '\0' || magic[i] == FRAME_RING_MAGIC[i];
+		if (!pending || waited >= FRAME_RING_OPEN_TIMEOUT * 1000000ULL) {
+			printf("<ring>: could not open the shared memory \"%s\".\n", shared_name);
+			free(shared_name);
+			return NULL;
+		}
+
+		if (waited == 0) printf("<ring>: waiting for the producer to create \"%s\"...\n", shared_name);
+		usleep(FRAME_RING_OPEN_POLL_US);
+	}
+}
+
+/*
+ * Parses a ring given as NAME[,SLOTS].
+ *
+ * Returns -1 if the text is not a correct ring, otherwise returns 0.
+ */
+int parse_frame_ring(char *text, char **name, u_int32_t *slot_count) {
+	char *comma = strchr(text, ',');
+	*slot_count = FRAME_RING_DEFAULT_SLOTS;
+	if (comma != NULL) {
+		int count = atoi(comma + 1);
+		if (count < 2) return -1;
+		*slot_count = count;
+		*comma = '\0';
+	}
+
+	*name = text;
+
+	return text[0] != '\0' && strchr(text + 1, '/') == NULL ? 0 : -1;
+}
+
+/*
+ * Waits until the slot of the next frame has been released by the reader.
+ *
+ * Returns the image of the slot to write the frame into.
+ */
+struct grayscale_image *acquire_frame_ring_slot(struct frame_ring *ring) {
+	struct frame_ring_header *header = ring->header;
+	u_int64_t head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+
+	while (head - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE) >= header->slot_count) usleep(FRAME_RING_POLL_US);
+
+	return &ring->slots[head % header->slot_count];
+}
+
+/*
+ * Hands the frame written into the acquired slot over to the reader.
+ */
+void publish_frame_ring_slot(struct frame_ring *ring) {
+	struct frame_ring_header *header = ring->header;
+	u_int64_t head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+
+	struct frame_ring_slot *slot = (struct frame_ring_slot *) ((u_int8_t *) (header + 1)
+	                                                          + (head % header->slot_count) * header->slot_size);
+	*slot = (struct frame_ring_slot) {.sequence = head, .width = header->width, .height = header->height, .scale = header->scale};
+
+	__atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Tells the reader that no more frames are coming.
+ */
+void finish_frame_ring(struct frame_ring *ring) {
+	__atomic_store_n(&ring->header->closed, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Waits for the next frame of the producer.
+ *
+ * Returns NULL once the producer has finished and all its frames are read,
+ * otherwise the image of the slot, valid until release_frame_ring_slot.
+ */
+struct grayscale_image *read_frame_ring_slot(struct frame_ring *ring) {
+	struct frame_ring_header *header = ring->header;
+	u_int64_t tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+
+	while (__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) == tail) {
+		// the producer may have published its last frame right before finishing
+		if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) == tail) return NULL;
+			break;
+		}
+		usleep(FRAME_RING_POLL_US);
+	}
+
+	return &ring->slots[tail % header->slot_count];
+}
+
+/*
+ * Gives the slot of the frame that has been read back to the producer.
+ */
+void release_frame_ring_slot(struct frame_ring *ring) {
+	u_int64_t tail = __atomic_load_n(&ring->header->tail, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->header->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Unmaps the ring from this process, the shared memory stays
+ * until unlink_frame_ring is called.
+ */
+void free_frame_ring(struct frame_ring *ring) {
+	for (u_int32_t i = 0; i < ring->header->slot_count; i++) free(ring->slots[i].matrix);
+	free(ring->slots);
+	munmap(ring->header, ring->size);
+	free(ring->name);
+	free(ring);
+}
+
+/*
+ * Removes the shared memory of the ring, the processes
+ * that have it mapped keep it until they unmap it.
+ */
+void unlink_frame_ring(char *name) {
+	char *shared_name = _get_shared_name(name);
+	shm_unlink(shared_name);
+	free(shared_name);
+}
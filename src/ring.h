@@ -0,0 +1,92 @@
+#ifndef OMP_RING_H
+#define OMP_RING_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* DEFINES */
+
+#define FRAME_RING_MAGIC "SOBRING\0"
+#define FRAME_RING_FORMAT_VERSION 1
+#define FRAME_RING_DEFAULT_SLOTS 4
+
+/*
+ * Every slot starts with a frame_ring_slot padded to this many bytes, the
+ * samples follow it; slots and rows of samples start on cache lines
+ */
+#define FRAME_RING_ALIGNMENT 64
+
+/*
+ * How long a side waits before looking at the counters of the other one again
+ */
+#define FRAME_RING_POLL_US 100
+
+/*
+ * How long a reader waits for the producer to create the ring, in seconds,
+ * and how often it looks for the ring meanwhile
+ */
+#define FRAME_RING_OPEN_TIMEOUT 30
+#define FRAME_RING_OPEN_POLL_US 10000
+
+/* STRUCTURES */
+
+/*
+ * The beginning of the shared memory of a ring. One process publishes frames,
+ * another one reads them straight from the memory. head counts the published
+ * frames and is only written by the producer, tail counts the frames the reader
+ * has released and is only written by the reader, so frame n is in slot
+ * n % slot_count and the producer may use it once tail > n - slot_count. The
+ * counters are on cache lines of their own and are accessed atomically.
+ * The slots follow the header.
+ */
+struct frame_ring_header {
+    char magic[8];
+    u_int32_t format_version;
+    u_int32_t slot_count;
+    u_int32_t width, height, scale; // of every frame in the ring
+    u_int32_t closed; // set by the producer after the last frame
+    u_int64_t slot_size; // bytes from the start of a slot to the start of the next one
+    u_int64_t head __attribute__((aligned(FRAME_RING_ALIGNMENT)));
+    u_int64_t tail __attribute__((aligned(FRAME_RING_ALIGNMENT)));
+} __attribute__((aligned(FRAME_RING_ALIGNMENT)));
+
+/*
+ * The beginning of a slot, followed by height rows of width 32-bit samples
+ */
+struct frame_ring_slot {
+    u_int64_t sequence; // number of the frame in the slot
+    u_int32_t width, height, scale;
+};
+
+/*
+ * A ring mapped into this process. Each slot has an image whose rows point
+ * into the shared memory, so that the sobel threads write their rows straight
+ * into the slot and the reader uses them without a copy.
+ */
+struct frame_ring {
+    char *name;
+    struct frame_ring_header *header;
+    size_t size;
+    struct grayscale_image *slots;
+};
+
+/* FUNCTIONS */
+
+/* Creating and opening */
+struct frame_ring *create_frame_ring(char *name, u_int32_t slot_count, u_int32_t width, u_int32_t height, u_int32_t scale);
+struct frame_ring *open_frame_ring(char *name);
+int parse_frame_ring(char *text, char **name, u_int32_t *slot_count);
+
+/* Producing */
+struct grayscale_image *acquire_frame_ring_slot(struct frame_ring *ring);
+void publish_frame_ring_slot(struct frame_ring *ring);
+void finish_frame_ring(struct frame_ring *ring);
+
+/* Reading */
+struct grayscale_image *read_frame_ring_slot(struct frame_ring *ring);
+void release_frame_ring_slot(struct frame_ring *ring);
+
+/* Memory */
+void free_frame_ring(struct frame_ring *ring);
+void unlink_frame_ring(char *name);
+
+#endif // OMP_RING_H
@@ -1,4 +1,6 @@
 #include "sobel.h"
+#include "kernels.h"
+#include "threads.h"
 #include <math.h> // for the square root
 #include <pthread.h>
 
@@ -47,12 +49,14 @@ u_int32_t calculate_sobel_at(struct grayscale_image *image, int x, int y) {
 
 /*
  * Converts the given RGB image to grayscale and call sobel_filter_grayscale_multithreaded
- * with the given number of threads.
+ * with the given number of threads. Both steps are done with the same number of threads.
  *
  * Returns a pointer to the resulting image.
  */
 struct grayscale_image *sobel_filter_rgb(struct rgb_image *image, int threads) {
-	struct grayscale_image *gray = rgb_to_grayscale_image(image);
+	struct grayscale_image *gray = convert_rgb_to_grayscale(image, GRAYSCALE_AVERAGE, threads);
+	if (gray == NULL) return NULL;
+
 	struct grayscale_image *result = sobel_filter_grayscale(gray, threads);
 
 	free_grayscale_image(gray);
@@ -61,12 +65,15 @@ struct grayscale_image *sobel_filter_rgb(struct rgb_image *image, int threads) {
 }
 
 /*
- * Applies the sobel operator to the given grayscale image, dividing the
- * work between the given number of threads.
+ * Applies the sobel operator to every color channel of the given RGB image
+ * without converting it to grayscale, so that edges between colors of the same
+ * brightness are kept. The gradients of the channels are combined according to
+ * the mode (SOBEL_COLOR_MAX or SOBEL_COLOR_DIZENZO), all three channels are
+ * processed in one pass. The rows are divided between the given number of threads.
  *
  * Returns a pointer to the resulting image.
  */
-struct grayscale_image *sobel_filter_grayscale(struct grayscale_image *image, int threads) {
+struct grayscale_image *sobel_filter_rgb_color(struct rgb_image *image, int mode, int threads) {
 	if (threads < 1) {
 		printf("<sobel>: number of threads cannot be less than one.\n");
 		return NULL;
@@ -80,75 +87,133 @@ struct grayscale_image *sobel_filter_grayscale(struct grayscale_image *image, in
 	// create the resulting structure
 	struct grayscale_image *result = create_grayscale_image(image->width, image->height, image->scale);
 
-	// overall number of pixels and pixel step for the thread
-	u_int32_t image_size = image->width * image->height;
-	u_int32_t step = image_size / threads;
+	printf("<sobel>: launching threads...\n");
 
-	u_int32_t thread_count = image_size / step;
-	pthread_t *thread_ids = (pthread_t *) calloc(thread_count, sizeof(pthread_t));
+	struct sobel_rgb_thread_task task = {.source_image = image, .destination_image = result, .mode = mode};
+	run_row_bands(image->height, threads, _sobel_filter_rgb_color_thread_job, (void *) &task);
 
-	printf("<sobel>: launching threads...\n");
+	printf("<sobel>: all threads have finished.\n");
 
-	for (u_int32_t s = 0; s < image_size; s += step) {
-		struct sobel_thread_task *task = (struct sobel_thread_task *) malloc(sizeof(struct sobel_thread_task));
+	return result;
+}
 
-		// set up the data for the upcoming thread
-		task->source_image = image;
-		task->destination_image = result;
+/*
+ * A helper function for the multithreaded color sobel filter. Calculates
+ * sobel for the band of rows given in the row_band_task.
+ *
+ * Returns NULL.
+ */
+void *_sobel_filter_rgb_color_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct sobel_rgb_thread_task *task = (struct sobel_rgb_thread_task *) band->context;
+	struct rgb_image *image = task->source_image;
+
+	// every thread gets its own scratch space for the channel planes
+	int32_t *scratch = (int32_t *) calloc(SOBEL_RGB_SCRATCH(image->width), sizeof(int32_t));
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		struct rgb_color *above = y > 0 ? image->matrix[y - 1] : NULL;
+		struct rgb_color *below = y + 1 < image->height ? image->matrix[y + 1] : NULL;
+		kernel_sobel_rgb_row(above, image->matrix[y], below, task->destination_image->matrix[y],
+		                     image->width, image->scale, task->mode, scratch);
+	}
 
-		// set the borders of calculation for this thread
-		task->from.y = s / image->width;
-		task->from.x = s % image->width;
-		task->to.y = (s + step) / image->width;
-		task->to.x = (s + step) % image->width;
+	free(scratch);
 
-		// make sure not to exceed the bounds of the image
-		if (task->to.y >= image->height) {
-			task->to.y = image->height - 1;
-			task->to.x = image->width - 1;
-		}
+	return NULL;
+}
+
+/*
+ * Maps the name of a color sobel mode: "max" or "dizenzo".
+ *
+ * Returns -1 if the name is unknown, otherwise returns the mode.
+ */
+int get_sobel_color_mode(char *name) {
+	if (strcmp(name, "max") == 0) return SOBEL_COLOR_MAX;
+	if (strcmp(name, "dizenzo") == 0) return SOBEL_COLOR_DIZENZO;
+	return -1;
+}
 
-		// create the thread and add its id to the array of ids
-		pthread_create(&thread_ids[s / step], NULL, _sobel_filter_grayscale_thread_job, (void *) task);
+/*
+ * Applies the sobel operator to the given grayscale image, dividing the
+ * work between the given number of threads.
+ *
+ * Returns a pointer to the resulting image.
+ */
+struct grayscale_image *sobel_filter_grayscale(struct grayscale_image *image, int threads) {
+	if (image == NULL) {
+		printf("<sobel>: met NULL instead of an existing image.\n");
+		return NULL;
 	}
 
-	printf("<sobel>: threads launched, working...\n");
+	// create the resulting structure
+	struct grayscale_image *result = create_grayscale_image(image->width, image->height, image->scale);
 
-	// wait for all threads to finish before continuing
-	for (int i = 0; i < thread_count; i++) {
-		pthread_join(thread_ids[i], NULL);
+	if (sobel_filter_grayscale_into(image, result, threads) != 0) {
+		free_grayscale_image(result);
+		return NULL;
 	}
 
-	printf("<sobel>: all threads have finished.\n");
+	return result;
+}
+
+/*
+ * Applies the sobel operator to the given grayscale image, writing the result
+ * into an existing image of the same size, e.g. one whose rows live in memory
+ * shared with another process.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int sobel_filter_grayscale_into(struct grayscale_image *image, struct grayscale_image *result, int threads) {
+	if (threads < 1) {
+		printf("<sobel>: number of threads cannot be less than one.\n");
+		return -1;
+	}
 
-	free(thread_ids);
+	if (image == NULL || result == NULL) {
+		printf("<sobel>: met NULL instead of an existing image.\n");
+		return -1;
+	}
 
-	return result;
+	if (image->width != result->width || image->height != result->height) {
+		printf("<sobel>: the result must be as large as the image.\n");
+		return -1;
+	}
+
+	printf("<sobel>: launching threads...\n");
+
+	// every thread gets a band of rows
+	struct sobel_thread_task task = {.source_image = image, .destination_image = result};
+	run_row_bands(image->height, threads, _sobel_filter_grayscale_thread_job, (void *) &task);
+
+	printf("<sobel>: all threads have finished.\n");
+
+	return 0;
 }
 
 /*
  * A helper function for the multithreaded sobel filter. Calculates sobel
- * in the specified region of the image.
+ * for the band of rows given in the row_band_task.
  *
  * Returns NULL.
  */
 void *_sobel_filter_grayscale_thread_job(void *data) {
-	// converting void pointer to a data structure
-	struct sobel_thread_task task = *((struct sobel_thread_task *) data);
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct sobel_thread_task *task = (struct sobel_thread_task *) band->context;
+	struct grayscale_image *image = task->source_image;
+
+	int32_t *scratch = (int32_t *) calloc(SOBEL_GRAYSCALE_SCRATCH(image->width), sizeof(int32_t));
 
-	// calculating sobel in the given region and saving the result
+	// calculating sobel in the given rows and saving the result
 	// into the image provided by the calling function
-	for (int y = task.from.y; y <= task.to.y; y++) {
-		int x_from = y == task.from.y ? task.from.x : 0;
-		int x_to = y == task.to.y ? task.to.x : task.source_image->width;
-		for (int x = x_from; x < x_to; x++) {
-			// get the sobel value for this pixel
-			task.destination_image->matrix[y][x] = calculate_sobel_at(task.source_image, x, y);
-		}
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		u_int32_t *above = y > 0 ? image->matrix[y - 1] : NULL;
+		u_int32_t *below = y + 1 < image->height ? image->matrix[y + 1] : NULL;
+		kernel_sobel_grayscale_row(above, image->matrix[y], below, task->destination_image->matrix[y],
+		                           0, image->width, image->width, image->scale, scratch);
 	}
 
-	// free the memory since it was allocated specifically for this function call
-	free(data);
+	free(scratch);
 
 	return NULL;
 }
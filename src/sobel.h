@@ -3,6 +3,11 @@
 
 #include "netpbm.h" // we are going to need image structures
 
+/* DEFINES */
+
+#define SOBEL_COLOR_MAX 1
+#define SOBEL_COLOR_DIZENZO 2
+
 /* STRUCTURES */
 
 /*
@@ -13,12 +18,22 @@ struct pixel_position {
 };
 
 /*
- * Contains the task for a single thread to run, regarding
- * the multithreaded sobel operation.
+ * Contains the data shared by the threads running
+ * the multithreaded sobel operation, every thread
+ * gets its own band of rows.
  */
 struct sobel_thread_task {
     struct grayscale_image *source_image, *destination_image;
-    struct pixel_position from, to;
+};
+
+/*
+ * Contains the data shared by the threads running the sobel
+ * operation on the color channels of an RGB image.
+ */
+struct sobel_rgb_thread_task {
+    struct rgb_image *source_image;
+    struct grayscale_image *destination_image;
+    int mode;
 };
 
 /* CONSTANTS */
@@ -30,10 +45,14 @@ extern const int sobel_kernel_y[3][3];
 
 /* Helpers */
 void *_sobel_filter_grayscale_thread_job(void *data);
+void *_sobel_filter_rgb_color_thread_job(void *data);
+int get_sobel_color_mode(char *name);
 u_int32_t calculate_sobel_at(struct grayscale_image *image, int x, int y);
 
 /* Sobel operation */
 struct grayscale_image *sobel_filter_grayscale(struct grayscale_image *image, int threads);
+int sobel_filter_grayscale_into(struct grayscale_image *image, struct grayscale_image *result, int threads);
 struct grayscale_image *sobel_filter_rgb(struct rgb_image *image, int threads);
+struct grayscale_image *sobel_filter_rgb_color(struct rgb_image *image, int mode, int threads);
 
 #endif // OMP_SOBEL_H
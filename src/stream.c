@@ -0,0 +1,330 @@
+#include "stream.h"
+#include "sobel.h"
+#include "incremental.h"
+#include "median.h"
+
+/*
+ * Prepares an empty queue.
+ */
+void frame_queue_init(struct frame_queue *queue) {
+	queue->head = 0;
+	queue->count = 0;
+	queue->closed = 0;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->changed, NULL);
+}
+
+/*
+ * Adds a frame to the end of the queue, waits while the queue is full.
+ */
+void frame_queue_push(struct frame_queue *queue, struct grayscale_image *frame) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == FRAME_QUEUE_SIZE) pthread_cond_wait(&queue->changed, &queue->lock);
+
+	queue->frames[(queue->head + queue->count) % FRAME_QUEUE_SIZE] = frame;
+	queue->count++;
+
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Takes a frame from the front of the queue, waits while the queue is empty.
+ *
+ * Returns NULL if the queue is closed and empty, otherwise returns the frame.
+ */
+struct grayscale_image *frame_queue_pop(struct frame_queue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == 0 && !queue->closed) pthread_cond_wait(&queue->changed, &queue->lock);
+
+	struct grayscale_image *frame = NULL;
+	if (queue->count > 0) {
+		frame = queue->frames[queue->head];
+		queue->head = (queue->head + 1) % FRAME_QUEUE_SIZE;
+		queue->count--;
+	}
+
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+
+	return frame;
+}
+
+/*
+ * Tells the next stage that no more frames are coming.
+ */
+void frame_queue_close(struct frame_queue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = 1;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Releases the synchronization primitives of the queue.
+ */
+void frame_queue_destroy(struct frame_queue *queue) {
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->changed);
+}
+
+/*
+ * Tells the other stages of the pipeline that one of them has failed.
+ */
+static void _fail_stream_pipeline(struct stream_pipeline *pipeline) {
+	__atomic_store_n(&pipeline->failed, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns 1 if a stage of the pipeline has failed, otherwise returns 0.
+ */
+static int _stream_pipeline_failed(struct stream_pipeline *pipeline) {
+	return __atomic_load_n(&pipeline->failed, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * The first stage of the pipeline: reads frames from the input until the
+ * stream ends or another stage fails and hands them to the filtering stage.
+ *
+ * Returns NULL.
+ */
+void *_decode_stream_job(void *data) {
+	struct stream_pipeline *pipeline = (struct stream_pipeline *) data;
+
+	while (!_stream_pipeline_failed(pipeline) && skip_to_next_frame(pipeline->input) != EOF) {
+		struct grayscale_image *frame = read_grayscale_frame(pipeline->input, pipeline->mode);
+		if (frame == NULL) {
+			printf("<stream>: could not read frame %u.\n", pipeline->frames_read);
+			_fail_stream_pipeline(pipeline);
+			break;
+		}
+
+		pipeline->frames_read++;
+		frame_queue_push(&pipeline->decoded, frame);
+	}
+
+	frame_queue_close(&pipeline->decoded);
+
+	return NULL;
+}
+
+/*
+ * The last stage of the pipeline: writes filtered frames to the output,
+ * flushing after each one so that the consumer gets them right away.
+ *
+ * Returns NULL.
+ */
+void *_encode_stream_job(void *data) {
+	struct stream_pipeline *pipeline = (struct stream_pipeline *) data;
+
+	struct grayscale_image *frame;
+	while ((frame = frame_queue_pop(&pipeline->filtered)) != NULL) {
+		// keep draining the queue after an error so that the other stages do not get stuck
+		if (!_stream_pipeline_failed(pipeline)) {
+			if (write_grayscale_frame(pipeline->output, frame, pipeline->format) != 0 || fflush(pipeline->output) != 0) {
+				printf("<stream>: could not write frame %u.\n", pipeline->frames_written);
+				_fail_stream_pipeline(pipeline);
+			} else {
+				pipeline->frames_written++;
+			}
+		}
+
+		free_grayscale_image(frame);
+	}
+
+	return NULL;
+}
+
+/*
+ * Filters a frame straight into the next slot of the frame ring and publishes
+ * it, creating the ring on the first frame. The incremental sobel keeps its
+ * own result, which is copied into the slot. Takes the ownership of the frame.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+static int _publish_ring_frame(struct stream_pipeline *pipeline, struct grayscale_image *frame,
+                               struct sobel_incremental *incremental) {
+	if (pipeline->ring == NULL) {
+		pipeline->ring = create_frame_ring(pipeline->ring_name, pipeline->ring_slots, frame->width, frame->height, frame->scale);
+	}
+
+	struct frame_ring *ring = pipeline->ring;
+	if (ring == NULL || frame->width != ring->header->width || frame->height != ring->header->height) {
+		if (ring != NULL) printf("<stream>: frame %u is not as large as the frames of the ring.\n", pipeline->frames_written);
+		free_grayscale_image(frame);
+		return -1;
+	}
+
+	struct grayscale_image *slot = acquire_frame_ring_slot(ring);
+	if (incremental != NULL) {
+		struct grayscale_image *sobel = sobel_filter_incremental(incremental, frame);
+		if (sobel == NULL) return -1;
+		for (u_int32_t y = 0; y < sobel->height; y++) memcpy(slot->matrix[y], sobel->matrix[y], sobel->width * sizeof(u_int32_t));
+	} else {
+		int result = pipeline->median_radius > 0
+		             ? sobel_filter_median_into(frame, slot, pipeline->median_radius, pipeline->threads)
+		             : sobel_filter_grayscale_into(frame, slot, pipeline->threads);
+		free_grayscale_image(frame);
+		if (result != 0) return -1;
+	}
+	publish_frame_ring_slot(ring);
+
+	return 0;
+}
+
+/*
+ * Runs the stages of the pipeline until the input ends.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+static int _run_stream_pipeline(struct stream_pipeline *pipeline) {
+	frame_queue_init(&pipeline->decoded);
+	frame_queue_init(&pipeline->filtered);
+
+	struct sobel_incremental *incremental = pipeline->tile_size > 0
+	                                        ? create_sobel_incremental(pipeline->tile_size, pipeline->threads) : NULL;
+
+	// frames published into a ring need no encoding
+	pthread_t decoder, encoder;
+	pthread_create(&decoder, NULL, _decode_stream_job, (void *) pipeline);
+	if (pipeline->ring_name == NULL) pthread_create(&encoder, NULL, _encode_stream_job, (void *) pipeline);
+
+	// the filtering stage runs on the calling thread
+	struct grayscale_image *frame;
+	while ((frame = frame_queue_pop(&pipeline->decoded)) != NULL) {
+		// keep draining the queue after an error so that the decoder does not get stuck
+		if (_stream_pipeline_failed(pipeline)) {
+			free_grayscale_image(frame);
+			continue;
+		}
+
+		if (pipeline->ring_name != NULL) {
+			if (_publish_ring_frame(pipeline, frame, incremental) != 0) _fail_stream_pipeline(pipeline);
+			else pipeline->frames_written++;
+			continue;
+		}
+
+		struct grayscale_image *sobel;
+		if (incremental != NULL) {
+			// the context keeps both the frame and its result, the encoder gets a copy
+			sobel = sobel_filter_incremental(incremental, frame);
+			if (sobel != NULL) sobel = copy_grayscale_image(sobel);
+		} else if (pipeline->median_radius > 0) {
+			sobel = sobel_filter_median(frame, pipeline->median_radius, pipeline->threads);
+			free_grayscale_image(frame);
+		} else {
+			sobel = sobel_filter_grayscale(frame, pipeline->threads);
+			free_grayscale_image(frame);
+		}
+
+		if (sobel == NULL) {
+			_fail_stream_pipeline(pipeline);
+			continue;
+		}
+
+		frame_queue_push(&pipeline->filtered, sobel);
+	}
+
+	frame_queue_close(&pipeline->filtered);
+
+	pthread_join(decoder, NULL);
+	if (pipeline->ring_name == NULL) pthread_join(encoder, NULL);
+
+	frame_queue_destroy(&pipeline->decoded);
+	frame_queue_destroy(&pipeline->filtered);
+
+	if (pipeline->ring != NULL) {
+		finish_frame_ring(pipeline->ring);
+		free_frame_ring(pipeline->ring);
+	}
+
+	printf("<stream>: %u frames read, %u frames written.\n", pipeline->frames_read, pipeline->frames_written);
+
+	if (incremental != NULL) {
+		printf("<stream>: incremental sobel skipped %.1f%% of the pixels.\n", 100 * sobel_incremental_skipped(incremental));
+		free_sobel_incremental(incremental);
+	}
+
+	return _stream_pipeline_failed(pipeline) ? -1 : 0;
+}
+
+/*
+ * Applies the sobel operator to every image of a multi-image Netpbm stream
+ * (for example, frames piped by a capture process) and writes the results to
+ * the output stream in the given format. Decoding, filtering and encoding run
+ * in separate stages, so frame N+1 is read while frame N is filtered and frame
+ * N-1 is written. Filtering itself uses the given number of threads.
+ *
+ * If tile_size is not 0, only the tiles that differ from the previous frame
+ * are recomputed, which pays off for a fixed camera. Otherwise, if
+ * median_radius is not 0, the frames are denoised by the median filter in
+ * the same pass as the sobel operator.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int sobel_filter_stream(FILE *input, FILE *output, int mode, int format, int threads, u_int32_t tile_size,
+                        u_int32_t median_radius) {
+	struct stream_pipeline pipeline = {
+		.input = input,
+		.output = output,
+		.mode = mode,
+		.format = format,
+		.threads = threads,
+		.tile_size = tile_size,
+		.median_radius = median_radius};
+
+	return _run_stream_pipeline(&pipeline);
+}
+
+/*
+ * Same as sobel_filter_stream, but publishes the frames into a frame ring in
+ * shared memory instead of encoding them: the threads write the rows straight
+ * into a slot and another process reads them from there without a copy. Waits
+ * for the reader when all the slots are taken.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int sobel_filter_stream_to_ring(FILE *input, char *ring_name, u_int32_t ring_slots, int mode, int threads, u_int32_t tile_size,
+                                u_int32_t median_radius) {
+	struct stream_pipeline pipeline = {
+		.input = input,
+		.mode = mode,
+		.threads = threads,
+		.tile_size = tile_size,
+		.median_radius = median_radius,
+		.ring_name = ring_name,
+		.ring_slots = ring_slots};
+
+	return _run_stream_pipeline(&pipeline);
+}
+
+/*
+ * Reads the frames of a frame ring until its producer finishes and writes them
+ * to the output stream, then removes the ring. Mostly for trying a ring out,
+ * a real reader uses the slots where they are.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int write_frame_ring_stream(char *ring_name, FILE *output, int format) {
+	struct frame_ring *ring = open_frame_ring(ring_name);
+	if (ring == NULL) return -1;
+
+	int failed = 0;
+	u_int32_t frames = 0;
+	struct grayscale_image *frame;
+	while ((frame = read_frame_ring_slot(ring)) != NULL) {
+		if (!failed && (write_grayscale_frame(output, frame, format) != 0 || fflush(output) != 0)) {
+			printf("<stream>: could not write frame %u.\n", frames);
+			failed = 1;
+		}
+		release_frame_ring_slot(ring);
+		frames++;
+	}
+
+	printf("<stream>: %u frames read from the ring.\n", frames);
+
+	free_frame_ring(ring);
+	unlink_frame_ring(ring_name);
+
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,68 @@
+#ifndef OMP_STREAM_H
+#define OMP_STREAM_H
+
+#include "netpbm.h" // we are going to need image structures
+#include "ring.h"
+#include <pthread.h>
+
+/* DEFINES */
+
+/*
+ * How many frames may wait between two stages of the pipeline
+ */
+#define FRAME_QUEUE_SIZE 2
+
+/* STRUCTURES */
+
+/*
+ * A bounded queue of frames handed from one stage of the pipeline to the next.
+ * Once closed, the queue still gives away the frames that are left in it.
+ */
+struct frame_queue {
+    struct grayscale_image *frames[FRAME_QUEUE_SIZE];
+    u_int32_t head, count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+/*
+ * Contains everything the stages of the stream pipeline share:
+ * the streams, the options and the queues between the stages.
+ * With a ring name the frames are published into a frame ring,
+ * created for the size of the first frame, instead of the output.
+ */
+struct stream_pipeline {
+    FILE *input, *output;
+    int mode, format, threads;
+    u_int32_t tile_size; // 0 if every frame is computed in full
+    u_int32_t median_radius; // 0 if the frames are not denoised
+    char *ring_name;
+    u_int32_t ring_slots;
+    struct frame_ring *ring;
+    struct frame_queue decoded, filtered;
+    u_int32_t frames_read, frames_written;
+    int failed; // set by any stage, accessed atomically
+};
+
+/* FUNCTIONS */
+
+/* Frame queue */
+void frame_queue_init(struct frame_queue *queue);
+void frame_queue_push(struct frame_queue *queue, struct grayscale_image *frame);
+struct grayscale_image *frame_queue_pop(struct frame_queue *queue);
+void frame_queue_close(struct frame_queue *queue);
+void frame_queue_destroy(struct frame_queue *queue);
+
+/* Helpers */
+void *_decode_stream_job(void *data);
+void *_encode_stream_job(void *data);
+
+/* Stream processing */
+int sobel_filter_stream(FILE *input, FILE *output, int mode, int format, int threads, u_int32_t tile_size,
+                        u_int32_t median_radius);
+int sobel_filter_stream_to_ring(FILE *input, char *ring_name, u_int32_t ring_slots, int mode, int threads, u_int32_t tile_size,
+                                u_int32_t median_radius);
+int write_frame_ring_stream(char *ring_name, FILE *output, int format);
+
+#endif // OMP_STREAM_H
@@ -0,0 +1,200 @@
+#include "threads.h"
+
+// the pool of the process, NULL unless start_thread_pool was called
+static struct thread_pool *_pool = NULL;
+
+/*
+ * Takes the next band of the batch, removing the batch from the queue of the
+ * pool once all its bands are taken. The lock of the pool must be held.
+ *
+ * Returns a pointer to the row_band_task of the band.
+ */
+static struct row_band_task *_take_band(struct row_band_batch *batch) {
+	struct row_band_task *task = &batch->tasks[batch->next++];
+	if (batch->next < batch->count) return task;
+
+	// all the bands are taken, the batch leaves the queue
+	struct row_band_batch *previous = NULL;
+	for (struct row_band_batch *queued = _pool->first; queued != batch; queued = queued->following) previous = queued;
+	if (previous != NULL) previous->following = batch->following;
+	else _pool->first = batch->following;
+	if (_pool->last == batch) _pool->last = previous;
+
+	return task;
+}
+
+/*
+ * Runs the bands but the first one on the threads of the pool, while the
+ * calling thread runs the first one and then helps with the rest of its own.
+ */
+static void _run_pooled_bands(struct row_band_task *tasks, u_int32_t count, void *(*job)(void *)) {
+	struct row_band_batch batch = {.job = job, .tasks = tasks, .count = count, .next = 1};
+	pthread_cond_init(&batch.finished, NULL);
+
+	pthread_mutex_lock(&_pool->lock);
+	if (_pool->last != NULL) _pool->last->following = &batch;
+	else _pool->first = &batch;
+	_pool->last = &batch;
+	pthread_cond_broadcast(&_pool->changed);
+	pthread_mutex_unlock(&_pool->lock);
+
+	job((void *) &tasks[0]);
+
+	pthread_mutex_lock(&_pool->lock);
+	while (batch.next < batch.count) {
+		struct row_band_task *task = _take_band(&batch);
+		pthread_mutex_unlock(&_pool->lock);
+		job((void *) task);
+		pthread_mutex_lock(&_pool->lock);
+		batch.done++;
+	}
+	while (batch.done < batch.count - 1) pthread_cond_wait(&batch.finished, &_pool->lock);
+	pthread_mutex_unlock(&_pool->lock);
+
+	pthread_cond_destroy(&batch.finished);
+}
+
+/*
+ * Splits the given number of rows into equal bands, one for each thread,
+ * and runs the job on every band. The job receives a pointer to its
+ * row_band_task. The calling thread takes the first band itself, so a
+ * single thread never spawns anything. If the thread pool is running,
+ * the other bands go to its threads instead of new ones.
+ *
+ * Returns -1 if error occurred, otherwise returns 0 once all the bands are done.
+ */
+int run_row_bands(u_int32_t rows, int threads, void *(*job)(void *), void *context) {
+	if (threads < 1) {
+		printf("<threads>: number of threads cannot be less than one.\n");
+		return -1;
+	}
+
+	if (rows == 0) return 0;
+
+	// there is no point in having more bands than rows
+	u_int32_t count = (u_int32_t) threads < rows ? (u_int32_t) threads : rows;
+
+	struct row_band_task *tasks = (struct row_band_task *) calloc(count, sizeof(struct row_band_task));
+
+	for (u_int32_t i = 0; i < count; i++) {
+		tasks[i] = (struct row_band_task) {
+			.context = context,
+			.index = i,
+			.count = count,
+			.from = (u_int32_t) ((u_int64_t) rows * i / count),
+			.to = (u_int32_t) ((u_int64_t) rows * (i + 1) / count)};
+	}
+
+	if (_pool != NULL && count > 1) {
+		_run_pooled_bands(tasks, count, job);
+		free(tasks);
+		return 0;
+	}
+
+	pthread_t *thread_ids = (pthread_t *) calloc(count, sizeof(pthread_t));
+
+	// launch all the bands but the first one
+	for (u_int32_t i = 1; i < count; i++) {
+		pthread_create(&thread_ids[i], NULL, job, (void *) &tasks[i]);
+	}
+
+	job((void *) &tasks[0]);
+
+	// wait for all threads to finish before continuing
+	for (u_int32_t i = 1; i < count; i++) {
+		pthread_join(thread_ids[i], NULL);
+	}
+
+	free(thread_ids);
+	free(tasks);
+
+	return 0;
+}
+
+/*
+ * Starts the given number of threads that wait for the bands of run_row_bands
+ * until stop_thread_pool is called.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int start_thread_pool(int threads) {
+	if (threads < 1) {
+		printf("<threads>: number of threads cannot be less than one.\n");
+		return -1;
+	}
+
+	if (_pool != NULL) {
+		printf("<threads>: the thread pool is already running.\n");
+		return -1;
+	}
+
+	struct thread_pool *pool = (struct thread_pool *) calloc(1, sizeof(struct thread_pool));
+	pool->threads = (pthread_t *) calloc(threads, sizeof(pthread_t));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->changed, NULL);
+
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, _thread_pool_job, (void *) pool) != 0) break;
+		pool->count++;
+	}
+
+	if (pool->count == 0) {
+		printf("<threads>: could not start the thread pool.\n");
+		free(pool->threads);
+		free(pool);
+		return -1;
+	}
+
+	_pool = pool;
+
+	return 0;
+}
+
+/*
+ * Lets the threads of the pool finish the bands they have already taken and
+ * joins them. Must not be called while run_row_bands is running.
+ */
+void stop_thread_pool() {
+	if (_pool == NULL) return;
+
+	pthread_mutex_lock(&_pool->lock);
+	_pool->stopping = 1;
+	pthread_cond_broadcast(&_pool->changed);
+	pthread_mutex_unlock(&_pool->lock);
+
+	for (int i = 0; i < _pool->count; i++) pthread_join(_pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&_pool->lock);
+	pthread_cond_destroy(&_pool->changed);
+	free(_pool->threads);
+	free(_pool);
+	_pool = NULL;
+}
+
+/*
+ * A thread of the pool. Takes the bands of the first batch in the queue one by
+ * one and lets the caller of run_row_bands know once all of them are done.
+ *
+ * Returns NULL.
+ */
+void *_thread_pool_job(void *data) {
+	struct thread_pool *pool = (struct thread_pool *) data;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (pool->first == NULL && !pool->stopping) pthread_cond_wait(&pool->changed, &pool->lock);
+		if (pool->first == NULL) break;
+
+		struct row_band_batch *batch = pool->first;
+		struct row_band_task *task = _take_band(batch);
+		pthread_mutex_unlock(&pool->lock);
+
+		batch->job((void *) task);
+
+		pthread_mutex_lock(&pool->lock);
+		if (++batch->done == batch->count - 1) pthread_cond_signal(&batch->finished);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
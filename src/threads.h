@@ -0,0 +1,58 @@
+#ifndef OMP_THREADS_H
+#define OMP_THREADS_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/* STRUCTURES */
+
+/*
+ * Contains the task for a single thread to run: a band of rows
+ * [from, to) of some image and the context shared by all the threads.
+ */
+struct row_band_task {
+    void *context;
+    u_int32_t index; // number of the band, 0..count-1
+    u_int32_t count; // overall number of bands
+    u_int32_t from, to;
+};
+
+/*
+ * One call of run_row_bands handed to the thread pool. The bands before next
+ * are taken, done counts the finished ones apart from the first band, which
+ * the calling thread always runs itself.
+ */
+struct row_band_batch {
+    void *(*job)(void *);
+    struct row_band_task *tasks;
+    u_int32_t count, next, done;
+    pthread_cond_t finished;
+    struct row_band_batch *following; // next batch in the queue
+};
+
+/*
+ * Threads kept alive between the calls of run_row_bands, so that a long-running
+ * process does not pay for creating them every time. They take the bands of
+ * the queued batches in order.
+ */
+struct thread_pool {
+    pthread_t *threads;
+    int count;
+    int stopping;
+    struct row_band_batch *first, *last;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+/* FUNCTIONS */
+
+int run_row_bands(u_int32_t rows, int threads, void *(*job)(void *), void *context);
+
+/* Thread pool */
+int start_thread_pool(int threads);
+void stop_thread_pool();
+void *_thread_pool_job(void *data);
+
+#endif // OMP_THREADS_H
@@ -0,0 +1,226 @@
+#include "threshold.h"
+#include "kernels.h"
+#include "threads.h"
+
+/*
+ * Runs one pass of the binarization over all the rows of the task. When the
+ * histograms are requested, every band gets its own zeroed histogram and
+ * they are merged into the first one after the pass.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+static int _run_threshold_pass(struct threshold_task *task, u_int32_t scale, int threads) {
+	u_int32_t bins = scale + 1;
+	if (task->histograms != NULL) memset(task->histograms, 0, (size_t) threads * bins * sizeof(u_int32_t));
+
+	if (run_row_bands(task->source_image->height, threads, _threshold_thread_job, (void *) task) != 0) return -1;
+
+	if (task->histograms != NULL) {
+		for (int i = 1; i < threads; i++) {
+			u_int32_t *histogram = task->histograms + (size_t) i * bins;
+			for (u_int32_t v = 0; v < bins; v++) task->histograms[v] += histogram[v];
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Applies the sobel operator to the given grayscale image and binarizes the
+ * magnitudes in the same pass: a pixel above the threshold becomes 1. With
+ * THRESHOLD_OTSU the magnitudes are kept and counted by every thread into its
+ * own histogram, the threshold is found by Otsu's method on the merged
+ * histogram and a second pass only compares the kept magnitudes.
+ *
+ * Returns NULL in case of an error or a pointer to the blackwhite_image structure.
+ */
+struct blackwhite_image *sobel_filter_threshold(struct grayscale_image *image, int threshold, int threads) {
+	if (threads < 1) {
+		printf("<threshold>: number of threads cannot be less than one.\n");
+		return NULL;
+	}
+
+	if (image == NULL) {
+		printf("<threshold>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct blackwhite_image *result = create_blackwhite_image(image->width, image->height);
+
+	if (threshold != THRESHOLD_OTSU) {
+		struct threshold_task task = {
+			.source_image = image,
+			.destination_image = result,
+			.sobel = 1,
+			.threshold = threshold};
+		_run_threshold_pass(&task, image->scale, threads);
+		return result;
+	}
+
+	struct grayscale_image *magnitudes = create_grayscale_image(image->width, image->height, image->scale);
+	u_int32_t *histograms = (u_int32_t *) malloc((size_t) threads * (image->scale + 1) * sizeof(u_int32_t));
+
+	// the sobel operator and the histograms
+	struct threshold_task task = {
+		.source_image = image,
+		.magnitude_image = magnitudes,
+		.sobel = 1,
+		.histograms = histograms};
+	_run_threshold_pass(&task, image->scale, threads);
+
+	// the comparison of the kept magnitudes
+	task = (struct threshold_task) {
+		.source_image = magnitudes,
+		.destination_image = result,
+		.threshold = calculate_otsu_threshold(histograms, image->scale)};
+	printf("<threshold>: Otsu threshold is %u.\n", task.threshold);
+	_run_threshold_pass(&task, image->scale, threads);
+
+	free(histograms);
+	free_grayscale_image(magnitudes);
+
+	return result;
+}
+
+/*
+ * Binarizes an image of already calculated magnitudes (e.g. the result of the
+ * color sobel): a pixel above the threshold becomes 1. With THRESHOLD_OTSU the
+ * threshold is found by Otsu's method from the histograms of all the threads.
+ *
+ * Returns NULL in case of an error or a pointer to the blackwhite_image structure.
+ */
+struct blackwhite_image *threshold_grayscale_image(struct grayscale_image *image, int threshold, int threads) {
+	if (threads < 1) {
+		printf("<threshold>: number of threads cannot be less than one.\n");
+		return NULL;
+	}
+
+	if (image == NULL) {
+		printf("<threshold>: met NULL instead of an existing image.\n");
+		return NULL;
+	}
+
+	struct blackwhite_image *result = create_blackwhite_image(image->width, image->height);
+	struct threshold_task task = {.source_image = image, .destination_image = result, .threshold = threshold};
+
+	if (threshold == THRESHOLD_OTSU) {
+		u_int32_t *histograms = (u_int32_t *) malloc((size_t) threads * (image->scale + 1) * sizeof(u_int32_t));
+		struct threshold_task count_task = {.source_image = image, .histograms = histograms};
+		_run_threshold_pass(&count_task, image->scale, threads);
+
+		task.threshold = calculate_otsu_threshold(histograms, image->scale);
+		printf("<threshold>: Otsu threshold is %u.\n", task.threshold);
+		free(histograms);
+	}
+
+	_run_threshold_pass(&task, image->scale, threads);
+
+	return result;
+}
+
+/*
+ * A helper function for the multithreaded binarization. Goes through the band
+ * of rows given in the row_band_task doing the steps the threshold_task asks for.
+ *
+ * Returns NULL.
+ */
+void *_threshold_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct threshold_task *task = (struct threshold_task *) band->context;
+	struct grayscale_image *image = task->source_image;
+
+	int32_t *scratch = NULL;
+	u_int32_t *magnitudes = NULL;
+	if (task->sobel) {
+		scratch = (int32_t *) calloc(SOBEL_GRAYSCALE_SCRATCH(image->width), sizeof(int32_t));
+		if (task->magnitude_image == NULL) magnitudes = (u_int32_t *) malloc(image->width * sizeof(u_int32_t));
+	}
+
+	u_int32_t *histogram = NULL;
+	if (task->histograms != NULL) histogram = task->histograms + (size_t) band->index * (image->scale + 1);
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		u_int32_t *row = image->matrix[y];
+
+		if (task->sobel) {
+			u_int32_t *above = y > 0 ? image->matrix[y - 1] : NULL;
+			u_int32_t *below = y + 1 < image->height ? image->matrix[y + 1] : NULL;
+			if (task->magnitude_image != NULL) row = task->magnitude_image->matrix[y];
+			else row = magnitudes;
+			kernel_sobel_grayscale_row(above, image->matrix[y], below, row,
+			                           0, image->width, image->width, image->scale, scratch);
+		}
+
+		if (histogram != NULL) {
+			for (u_int32_t x = 0; x < image->width; x++) histogram[row[x] <= image->scale ? row[x] : image->scale]++;
+		}
+
+		if (task->destination_image != NULL) {
+			kernel_threshold_row(row, task->destination_image->matrix[y], image->width, task->threshold);
+		}
+	}
+
+	free(scratch);
+	free(magnitudes);
+
+	return NULL;
+}
+
+/*
+ * Finds the threshold that splits the histogram of values 0..scale into two
+ * classes with the largest variance between them (Otsu's method). The values
+ * up to and including the threshold form the first class.
+ *
+ * Returns the threshold.
+ */
+u_int32_t calculate_otsu_threshold(u_int32_t *histogram, u_int32_t scale) {
+	u_int64_t total = 0;
+	double sum = 0;
+	for (u_int32_t v = 0; v <= scale; v++) {
+		total += histogram[v];
+		sum += (double) v * histogram[v];
+	}
+
+	u_int32_t threshold = 0;
+	double best = -1;
+	u_int64_t count = 0;
+	double partial = 0;
+	for (u_int32_t v = 0; v <= scale; v++) {
+		count += histogram[v];
+		partial += (double) v * histogram[v];
+		if (count == 0) continue;
+		if (count == total) {
+			if (best < 0) threshold = v; // a single value, nothing to split
+			break;
+		}
+
+		// between-class variance up to a constant factor
+		double difference = partial * total - sum * count;
+		double variance = difference / count * difference / (total - count);
+		if (variance > best) {
+			best = variance;
+			threshold = v;
+		}
+	}
+
+	return threshold;
+}
+
+/*
+ * Parses the threshold option: a number or "otsu".
+ *
+ * Returns -1 if the text is incorrect, otherwise returns 0.
+ */
+int parse_threshold(char *text, int *threshold) {
+	if (strcmp(text, "otsu") == 0) {
+		*threshold = THRESHOLD_OTSU;
+		return 0;
+	}
+
+	char *end;
+	long value = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || value < 0 || value > 65535) return -1;
+
+	*threshold = (int) value;
+	return 0;
+}
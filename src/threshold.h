@@ -0,0 +1,38 @@
+#ifndef OMP_THRESHOLD_H
+#define OMP_THRESHOLD_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* DEFINES */
+
+#define THRESHOLD_OTSU -1
+
+/* STRUCTURES */
+
+/*
+ * Contains the data shared by the threads binarizing an image. Every row of
+ * the source goes through the sobel operator first if sobel is set, the
+ * magnitudes are then stored into magnitude_image, counted in the histogram
+ * of the band and compared with the threshold into destination_image, each
+ * step only if its target is not NULL.
+ */
+struct threshold_task {
+    struct grayscale_image *source_image, *magnitude_image;
+    struct blackwhite_image *destination_image;
+    int sobel;
+    u_int32_t threshold;
+    u_int32_t *histograms; // scale + 1 bins for every band, one after another
+};
+
+/* FUNCTIONS */
+
+/* Helpers */
+void *_threshold_thread_job(void *data);
+int parse_threshold(char *text, int *threshold);
+u_int32_t calculate_otsu_threshold(u_int32_t *histogram, u_int32_t scale);
+
+/* Binarization */
+struct blackwhite_image *sobel_filter_threshold(struct grayscale_image *image, int threshold, int threads);
+struct blackwhite_image *threshold_grayscale_image(struct grayscale_image *image, int threshold, int threads);
+
+#endif // OMP_THRESHOLD_H
@@ -0,0 +1,295 @@
+#include "tuning.h"
+#include "incremental.h"
+#include "kernels.h"
+#include "threads.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Returns the time of a monotonic clock in seconds.
+ */
+static double _now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*
+ * Runs the job over the rows TUNING_REPEATS times.
+ *
+ * Returns the shortest time of a run in seconds.
+ */
+static double _time_row_bands(u_int32_t rows, int threads, void *(*job)(void *), void *context) {
+	double best = -1;
+	for (int i = 0; i < TUNING_REPEATS; i++) {
+		double start = _now();
+		run_row_bands(rows, threads, job, context);
+		double time = _now() - start;
+		if (best < 0 || time < best) best = time;
+	}
+
+	return best;
+}
+
+/*
+ * Changes a few small spots of the frame, a different set for every seed,
+ * the way a mostly static video changes from one frame to the next.
+ */
+static void _change_spots(struct grayscale_image *frame, u_int32_t seed) {
+	for (u_int32_t i = 0; i < 8; i++) {
+		u_int32_t x = (seed * 7919 + i * 104729) % (frame->width - 4);
+		u_int32_t y = (seed * 6271 + i * 15485863) % (frame->height - 4);
+		for (u_int32_t dy = 0; dy < 4; dy++) {
+			for (u_int32_t dx = 0; dx < 4; dx++) frame->matrix[y + dy][x + dx] ^= 0x55;
+		}
+	}
+}
+
+/*
+ * Measures this host: how long the sobel operator takes per pixel, how long it
+ * takes to start and join a thread, and which tile size makes the incremental
+ * sobel the fastest on a mostly static frame. Takes a fraction of a second.
+ *
+ * Returns a pointer to the sobel_tuning structure.
+ */
+struct sobel_tuning *calibrate_sobel_tuning(const char *tier) {
+	struct sobel_tuning *tuning = (struct sobel_tuning *) calloc(1, sizeof(struct sobel_tuning));
+	gethostname(tuning->host, sizeof(tuning->host) - 1);
+	tuning->cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (tuning->cores < 1) tuning->cores = 1;
+	strncpy(tuning->tier, tier, sizeof(tuning->tier) - 1);
+
+	// a noisy image, so that the kernel does the same work as on a real one
+	struct grayscale_image *image = create_grayscale_image(TUNING_IMAGE_WIDTH, TUNING_IMAGE_HEIGHT, 255);
+	u_int32_t noise = 2463534242u;
+	for (u_int32_t y = 0; y < image->height; y++) {
+		for (u_int32_t x = 0; x < image->width; x++) {
+			noise ^= noise << 13;
+			noise ^= noise >> 17;
+			noise ^= noise << 5;
+			image->matrix[y][x] = noise & 0xff;
+		}
+	}
+	struct grayscale_image *result = create_grayscale_image(image->width, image->height, image->scale);
+
+	// the cost of a pixel on a single thread and the cost of a thread with nothing to do
+	struct tuning_task task = {.source_image = image, .destination_image = result};
+	double pixel_time = _time_row_bands(image->height, 1, _calibration_sobel_thread_job, (void *) &task)
+	                    / ((double) image->width * image->height);
+	double thread_time = 0;
+	if (tuning->cores > 1) {
+		thread_time = _time_row_bands(tuning->cores, tuning->cores, _calibration_empty_thread_job, NULL)
+		              / (tuning->cores - 1);
+	}
+
+	double band_pixels = thread_time / pixel_time * TUNING_OVERHEAD_SHARE;
+	tuning->band_pixels = band_pixels > TUNING_MIN_BAND_PIXELS ? (u_int32_t) band_pixels : TUNING_MIN_BAND_PIXELS;
+
+	// the tile sizes race on the same sequence of frames
+	u_int32_t tile_sizes[] = {16, 32, 64, 128};
+	double best = -1;
+	for (int i = 0; i < sizeof(tile_sizes) / sizeof(u_int32_t); i++) {
+		struct sobel_incremental *context = create_sobel_incremental(tile_sizes[i], 1);
+		sobel_filter_incremental(context, copy_grayscale_image(image));
+
+		double time = -1;
+		for (u_int32_t seed = 1; seed <= TUNING_REPEATS; seed++) {
+			struct grayscale_image *frame = copy_grayscale_image(image);
+			_change_spots(frame, seed);
+
+			double start = _now();
+			sobel_filter_incremental(context, frame);
+			double frame_time = _now() - start;
+			if (time < 0 || frame_time < time) time = frame_time;
+		}
+		free_sobel_incremental(context);
+
+		if (best < 0 || time < best) {
+			best = time;
+			tuning->tile_size = tile_sizes[i];
+		}
+	}
+
+	free_grayscale_image(image);
+	free_grayscale_image(result);
+
+	return tuning;
+}
+
+/*
+ * A helper function for the calibration. Calculates sobel for the band of rows
+ * given in the row_band_task, as _sobel_filter_grayscale_thread_job does.
+ *
+ * Returns NULL.
+ */
+void *_calibration_sobel_thread_job(void *data) {
+	struct row_band_task *band = (struct row_band_task *) data;
+	struct tuning_task *task = (struct tuning_task *) band->context;
+	struct grayscale_image *image = task->source_image;
+
+	int32_t *scratch = (int32_t *) calloc(SOBEL_GRAYSCALE_SCRATCH(image->width), sizeof(int32_t));
+
+	for (u_int32_t y = band->from; y < band->to; y++) {
+		u_int32_t *above = y > 0 ? image->matrix[y - 1] : NULL;
+		u_int32_t *below = y + 1 < image->height ? image->matrix[y + 1] : NULL;
+		kernel_sobel_grayscale_row(above, image->matrix[y], below, task->destination_image->matrix[y],
+		                           0, image->width, image->width, image->scale, scratch);
+	}
+
+	free(scratch);
+
+	return NULL;
+}
+
+/*
+ * A helper function for the calibration that does nothing, so that only
+ * starting and joining the thread is measured.
+ *
+ * Returns NULL.
+ */
+void *_calibration_empty_thread_job(void *data) {
+	return NULL;
+}
+
+/*
+ * Finds where the tuning file is kept: the path in the TUNING_FILE_ENV
+ * environment variable, or TUNING_FILE_NAME in the cache directory of the user.
+ *
+ * Returns NULL if there is no place for it, otherwise a path to be freed.
+ */
+char *get_tuning_path() {
+	char *path = getenv(TUNING_FILE_ENV);
+	if (path != NULL) return strdup(path);
+
+	char *cache = getenv("XDG_CACHE_HOME");
+	char *home = getenv("HOME");
+	if (cache != NULL && cache[0] == '\0') cache = NULL;
+	if (cache == NULL && (home == NULL || home[0] == '\0')) return NULL;
+
+	char *directory;
+	if (cache != NULL) {
+		directory = strdup(cache);
+	} else {
+		directory = (char *) malloc(strlen(home) + 8);
+		sprintf(directory, "%s/.cache", home);
+	}
+	mkdir(directory, 0755);
+
+	path = (char *) malloc(strlen(directory) + strlen(TUNING_FILE_NAME) + 2);
+	sprintf(path, "%s/%s", directory, TUNING_FILE_NAME);
+	free(directory);
+
+	return path;
+}
+
+/*
+ * Looks for the parameters of this host in the tuning file. They are only
+ * used if the number of online cores and the tier of the kernels are the same
+ * as when they were tuned.
+ *
+ * Returns NULL if there are no usable parameters, otherwise a pointer to the sobel_tuning structure.
+ */
+struct sobel_tuning *load_sobel_tuning(char *path, const char *tier) {
+	FILE *stream = fopen(path, "r");
+	if (stream == NULL) return NULL;
+
+	char host[64] = {};
+	gethostname(host, sizeof(host) - 1);
+	int cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	char line[256];
+	struct sobel_tuning *tuning = (struct sobel_tuning *) calloc(1, sizeof(struct sobel_tuning));
+	int correct = fgets(line, sizeof(line), stream) != NULL && strncmp(line, TUNING_HEADER, strlen(TUNING_HEADER)) == 0;
+	int found = 0;
+	while (correct && !found && fgets(line, sizeof(line), stream) != NULL) {
+		int fields = sscanf(line, "%63s %d %15s %u %u", tuning->host, &tuning->cores, tuning->tier,
+		                    &tuning->band_pixels, &tuning->tile_size);
+		found = fields == 5 && strcmp(tuning->host, host) == 0;
+	}
+	fclose(stream);
+
+	if (!found || tuning->cores != cores || strcmp(tuning->tier, tier) != 0
+	    || tuning->band_pixels == 0 || tuning->tile_size == 0) {
+		free(tuning);
+		return NULL;
+	}
+
+	return tuning;
+}
+
+/*
+ * Saves the parameters into the tuning file, replacing the line of the same
+ * host and keeping the lines of the other ones. The file is replaced at once,
+ * so that runs on other hosts sharing it never see half of it.
+ *
+ * Returns -1 if error occurred, otherwise returns 0.
+ */
+int save_sobel_tuning(char *path, struct sobel_tuning *tuning) {
+	char *temporary = (char *) malloc(strlen(path) + 16);
+	sprintf(temporary, "%s.%d", path, (int) getpid());
+
+	FILE *output = fopen(temporary, "w");
+	if (output == NULL) {
+		printf("<tuning>: could not open file for writing.\n");
+		free(temporary);
+		return -1;
+	}
+	fprintf(output, "%s\n", TUNING_HEADER);
+
+	FILE *input = fopen(path, "r");
+	if (input != NULL) {
+		char line[256], host[64];
+		int correct = fgets(line, sizeof(line), input) != NULL && strncmp(line, TUNING_HEADER, strlen(TUNING_HEADER)) == 0;
+		while (correct && fgets(line, sizeof(line), input) != NULL) {
+			if (sscanf(line, "%63s", host) == 1 && strcmp(host, tuning->host) != 0) fputs(line, output);
+		}
+		fclose(input);
+	}
+
+	fprintf(output, "%s %d %s %u %u\n", tuning->host, tuning->cores, tuning->tier, tuning->band_pixels, tuning->tile_size);
+
+	int failed = ferror(output);
+	failed = fclose(output) != 0 || failed;
+	if (!failed) failed = rename(temporary, path) != 0;
+	if (failed) {
+		printf("<tuning>: could not write the tuning file.\n");
+		remove(temporary);
+	}
+	free(temporary);
+
+	return failed ? -1 : 0;
+}
+
+/*
+ * Loads the parameters of this host, or calibrates and saves them if there
+ * are none yet or the host has changed. Without a path nothing is saved.
+ *
+ * Returns a pointer to the sobel_tuning structure.
+ */
+struct sobel_tuning *get_sobel_tuning(char *path, const char *tier) {
+	struct sobel_tuning *tuning = path != NULL ? load_sobel_tuning(path, tier) : NULL;
+	if (tuning != NULL) return tuning;
+
+	printf("<tuning>: calibrating for this host...\n");
+	tuning = calibrate_sobel_tuning(tier);
+	printf("<tuning>: %u pixels are worth a thread, tiles of %u pixels are the fastest.\n",
+	       tuning->band_pixels, tuning->tile_size);
+
+	if (path != NULL) save_sobel_tuning(path, tuning);
+
+	return tuning;
+}
+
+/*
+ * Picks the number of threads for the given amount of pixels: one for every
+ * band_pixels of them, but not more than there are online cores.
+ *
+ * Returns the number of threads.
+ */
+int get_tuned_threads(struct sobel_tuning *tuning, u_int64_t pixels) {
+	u_int64_t threads = pixels / tuning->band_pixels;
+	if (threads > (u_int64_t) tuning->cores) threads = tuning->cores;
+	return threads > 0 ? (int) threads : 1;
+}
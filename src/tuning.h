@@ -0,0 +1,66 @@
+#ifndef OMP_TUNING_H
+#define OMP_TUNING_H
+
+#include "netpbm.h" // we are going to need image structures
+
+/* DEFINES */
+
+#define TUNING_HEADER "netpbm-sobel tuning 1"
+#define TUNING_FILE_ENV "SOBEL_TUNING_FILE"
+#define TUNING_FILE_NAME "netpbm-sobel.tuning"
+
+/*
+ * A thread is only worth it when the overhead of starting it stays
+ * below 1 / TUNING_OVERHEAD_SHARE of the work of its band
+ */
+#define TUNING_OVERHEAD_SHARE 10
+#define TUNING_MIN_BAND_PIXELS 4096
+
+/*
+ * The calibration image and the tile sizes tried on it
+ */
+#define TUNING_IMAGE_WIDTH 1024
+#define TUNING_IMAGE_HEIGHT 512
+#define TUNING_REPEATS 5
+
+/* STRUCTURES */
+
+/*
+ * Parameters tuned for one host. They stay valid while the host has the same
+ * number of online cores and runs the same tier of the kernels. On disk every
+ * host takes one line of the tuning file, after the TUNING_HEADER line.
+ */
+struct sobel_tuning {
+    char host[64];
+    int cores;
+    char tier[16];
+    u_int32_t band_pixels; // the smallest band worth a thread of its own
+    u_int32_t tile_size; // for the incremental sobel
+};
+
+/*
+ * Contains the data shared by the threads of one calibration run
+ */
+struct tuning_task {
+    struct grayscale_image *source_image, *destination_image;
+};
+
+/* FUNCTIONS */
+
+/* Helpers */
+void *_calibration_sobel_thread_job(void *data);
+void *_calibration_empty_thread_job(void *data);
+char *get_tuning_path();
+
+/* Calibration */
+struct sobel_tuning *calibrate_sobel_tuning(const char *tier);
+
+/* Reading and writing */
+struct sobel_tuning *load_sobel_tuning(char *path, const char *tier);
+int save_sobel_tuning(char *path, struct sobel_tuning *tuning);
+struct sobel_tuning *get_sobel_tuning(char *path, const char *tier);
+
+/* Choosing the parameters */
+int get_tuned_threads(struct sobel_tuning *tuning, u_int64_t pixels);
+
+#endif // OMP_TUNING_H